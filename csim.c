@@ -4,7 +4,17 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <math.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 /*Tony Bumatay; tony.bumatay*/
 
@@ -20,63 +30,557 @@ typedef struct {
    int hits;
    int misses;
    int evicts;
+
+   int compulsory; //miss breakdown, only filled in with --classify
+   int capacity;
+   int conflict;
+
+   int pf_issued; //prefetch statistics, only filled in with --prefetch
+   int pf_useful; //prefetched line later hit by a demand access
+   int pf_late; //demand miss on a block whose prefetch was still in flight
+   int pf_polluting; //demand miss on a block that a prefetch fill had evicted
+
+   int victim_hits; //misses recovered by the victim cache (--victim)
+
+   int tag_misses; //sectored caches only (--sectors): misses that allocated a new line
+   int sector_misses; //misses on a resident line whose sector was not valid yet
+   int writebacks; //dirty sectors written back on eviction
 } cache_attributes;
 
+//a set line packed into one word: [ tag | sector dirty | sector valid | LRU rank | prefetched | dirty | valid ]
+//the rank takes ceil(log2 E) bits (0 = most recently used) and the tag sits above it,
+//so a line needs 8 bytes whenever the tag fits in the remaining bits; the two sector
+//fields take one bit per sector and only exist in a sectored cache (LINE_VALID is then the tag's valid bit)
 typedef struct {//define a struct for a set line
-   int last_used;
-   int valid;
-   mem_address_tag tag;
-   char *block;
-   unsigned LRU_counter; 
+   mem_address_tag bits;
 }set_line;
 
+#define LINE_VALID 1ULL
+#define LINE_DIRTY 2ULL //written since the fill; kept only when track_dirty (write buffer or DRAM)
+#define LINE_PREFETCHED 4ULL //filled by the prefetcher and not yet used by a demand access
+#define LINE_FLAG_BITS 3
+
 typedef struct {//define a struct for a cache set; contains a set line
    set_line *lines; //line in each set
 } cache_set;
 
+//open-addressing hash table keyed by block address (linear probing)
+typedef struct {
+   mem_address_tag *keys; //block address + 1; 0 marks an empty slot
+   int *values;
+   unsigned long long mask; //number of slots - 1 (slots is a power of 2)
+   unsigned long long count;
+} block_table;
+
+//fully-associative LRU: block_table for lookup plus an intrusive doubly linked list
+typedef struct {
+   block_table index; //block address -> node
+   mem_address_tag *keys;
+   int *prev;
+   int *next;
+   int head; //most recently used node
+   int tail; //least recently used node
+   int used;
+   int capacity;
+   unsigned char *dirty; //per node; only the cache engine sets it (stores with track_dirty)
+   mem_address_tag last_evicted; //key pushed out by the latest evicting access
+   int last_evicted_dirty;
+} lru_table;
+
+//three-C miss classifier: first-touch set plus a fully-associative shadow of equal capacity
+typedef struct {
+   block_table seen;
+   lru_table shadow;
+} miss_classifier;
+
+#define MISS_COMPULSORY 0
+#define MISS_CAPACITY 1
+#define MISS_CONFLICT 2
+
+#define PREFETCH_NEXT_LINE 0
+#define PREFETCH_STRIDE 1
+#define PREFETCH_STREAM 2
+
+#define PREFETCH_STREAMS 8 //streams tracked by the stream prefetcher
+#define PREFETCH_WINDOW 16 //blocks a miss may be away from a stream and still extend it
+#define PREFETCH_QUEUE 64 //prefetches in flight when there is a fill latency
+
+typedef struct {
+   mem_address_tag last_block;
+   int direction; //+1 or -1, 0 until the second miss
+   int confidence;
+   long long last_used;
+} prefetch_stream;
+
+//prefetch engine attached to a cache; fills do not count as demand accesses
+typedef struct {
+   int kind;
+   int degree; //blocks prefetched per trigger
+   int distance; //how far ahead of the trigger the first prefetch lands, in strides
+   int latency; //demand accesses before a prefetch fill lands (0 = immediately)
+   long long now; //demand access count
+
+   mem_address_tag last_block; //stride detector
+   long long last_stride;
+   int confidence;
+
+   prefetch_stream streams[PREFETCH_STREAMS];
+
+   mem_address_tag pending[PREFETCH_QUEUE]; //in-flight prefetches and when they land
+   long long ready[PREFETCH_QUEUE];
+   int num_pending;
+
+   block_table polluted; //blocks evicted by prefetch fills and not referenced since
+} prefetcher;
+
+//small fully-associative buffer of evicted blocks; the tag array is contiguous so the probe vectorizes
+typedef struct {
+   mem_address_tag *blocks; //block address + 1; 0 marks an empty entry
+   unsigned *stamps; //last insertion, for picking the LRU entry
+   int entries;
+   unsigned clock;
+} victim_cache;
+
+typedef struct tlb_model tlb_model;
+
+#define RUN_FILTER_MAX 16
+
+//recently used blocks that are known to be the MRU line of their set; under LRU a repeat
+//access to one of them is a hit that leaves the set's ordering unchanged
+typedef struct {
+   mem_address_tag blocks[RUN_FILTER_MAX]; //block address + 1; 0 marks an empty entry
+   unsigned long long sets[RUN_FILTER_MAX];
+   int size;
+   int next; //round-robin replacement
+   long long filtered; //accesses answered without touching a set
+} run_filter;
+
+#define FA_ENGINE_WAYS 32 //a single set at least this wide is simulated by the hashed engine
+
+#define MAX_TENANTS 16
+
+//CAT-style way partitioning of a shared cache: any tenant may hit in any way, but a miss
+//only fills (and evicts from) the ways in the accessing tenant's mask
+typedef struct partition_state {
+   int num_tenants;
+   int tenant; //tenant of the access being simulated
+   mem_address_tag masks[MAX_TENANTS]; //bit i = way i
+   unsigned char *owner; //tenant that filled each line, set after set
+   long long cross_evicts[MAX_TENANTS]; //fills by this tenant that evicted another tenant's line
+   long long lost[MAX_TENANTS]; //lines of this tenant evicted by another tenant
+} partition_state;
+
+#define INDEX_BITS 0 //plain bit slice of the address
+#define INDEX_XOR 1 //XOR of all s-bit chunks of the block address
+#define INDEX_MATRIX 2 //each index bit is the parity of the block address under one row mask
+
+#define MAX_MATRIX_ROWS 32
+
 typedef struct {
-   cache_set *sets;//sets in each cache
+   set_line *lines;//lines of all sets, set after set
+   int num_lines; //E
+
+   //packed line layout, see set_line
+   int tag_shift; //LINE_FLAG_BITS + rank bits
+   mem_address_tag rank_mask; //in place, i.e. already shifted by LINE_FLAG_BITS
+   int sectors; //sectors per line, 0 = unsectored
+   int sector_bits; //log2 sectors
+   int sector_shift; //position of sector 0's valid bit; sector i's dirty bit is sectors higher
+
+   //set indexing; the defaults give the classic address << tag_size >> (tag_size + b) slice
+   int index_mode;
+   int full_tag; //1 when the index is not a bit slice: lines then store the whole block address
+   unsigned long long num_sets;
+   unsigned long long fastmod_M; //precomputed for reducing by a non-power-of-two num_sets
+   int matrix_rows;
+   mem_address_tag *matrix; //matrix_rows row masks; behind a pointer so the struct stays cheap to pass by value
+
+   tlb_model *tlb; //NULL unless --tlb; consulted before the cache lookup
+   run_filter *filter; //NULL when --run-filter 0
+   miss_classifier *classifier; //NULL unless --classify
+   prefetcher *prefetch; //NULL unless --prefetch
+   victim_cache *victim; //NULL unless --victim
+   struct opt_state *opt; //NULL unless --policy opt; replaces LRU entirely
+   struct timing_model *timing; //NULL unless --timing
+   lru_table *fa; //NULL unless the cache is one wide set (s=0, E >= FA_ENGINE_WAYS); replaces the line scan
+   struct partition_state *partition; //NULL unless --tenants; restricts fills to the tenant's ways
+   struct write_buffer *wbuf; //NULL unless --write-buffer
+   struct dram_model *dram; //NULL unless --dram; receives misses, prefetch fills and writebacks
+   int track_dirty; //stores set LINE_DIRTY (with --write-buffer or --dram)
 }cache;//define a struct for a cache; contains a cache set
 
+//view of one set's lines
+static inline cache_set cache_set_at(cache *my_cache, unsigned long long set_index){
+   cache_set set;
+   set.lines = my_cache->lines + set_index * my_cache->num_lines;
+   return set;
+}
+
+static inline mem_address_tag line_tag(cache *my_cache, set_line line){
+   return line.bits >> my_cache->tag_shift;
+}
+
+static inline unsigned line_rank(cache *my_cache, set_line line){
+   return (line.bits & my_cache->rank_mask) >> LINE_FLAG_BITS;
+}
+
+
+#define PWC_LEVELS 3 //upper levels of a 4-level x86-64 walk (PML4, PDPT, PD)
+
+//two-level TLB plus optional page-walk cache; every level is an ordinary cache
+//whose "blocks" are pages, so lookups go through simulate_cache()
+struct tlb_model {
+   int page_bits; //12, 21 or 30 for 4K, 2M or 1G pages
+   cache dtlb;
+   cache_attributes dtlb_stats;
+   int use_stlb;
+   cache stlb;
+   cache_attributes stlb_stats;
+   int use_pwc;
+   cache pwc[PWC_LEVELS]; //pwc[0] is the deepest upper level for this page size
+   cache_attributes pwc_stats[PWC_LEVELS];
+
+   int walks;
+   long long walk_refs; //page-table entries read from memory
+};
+
+
+//mix the bits of a block address so neighbouring blocks spread over the table
+static inline unsigned long long hash_block(mem_address_tag key){
+   key ^= key >> 33;
+   key *= 0xff51afd7ed558ccdULL;
+   key ^= key >> 33;
+   key *= 0xc4ceb9fe1a85ec53ULL;
+   key ^= key >> 33;
+   return key;
+}
+
+void block_table_init(block_table *table, unsigned long long capacity){
+   unsigned long long slots = 16;
+   while (slots < capacity * 2){
+      slots <<= 1;
+   }
+   table->keys = (mem_address_tag *) calloc(slots, sizeof(mem_address_tag));
+   table->values = (int *) calloc(slots, sizeof(int));
+   table->mask = slots - 1;
+   table->count = 0;
+}
+
+void block_table_free(block_table *table){
+   free(table->keys);
+   free(table->values);
+}
+
+//return the slot holding key, or -1 if it is not in the table
+static inline long long block_table_find(block_table *table, mem_address_tag key){
+   unsigned long long slot = hash_block(key) & table->mask;
+   key++;
+   while (table->keys[slot] != 0){
+      if (table->keys[slot] == key){
+         return slot;
+      }
+      slot = (slot + 1) & table->mask;
+   }
+   return -1;
+}
+
+static void block_table_grow(block_table *table);
+
+//return the slot for key, inserting it with value 0 if it is missing
+static inline unsigned long long block_table_insert(block_table *table, mem_address_tag key, int *inserted){
+   if ((table->count + 1) * 2 > table->mask + 1){
+      block_table_grow(table);
+   }
+   unsigned long long slot = hash_block(key) & table->mask;
+   *inserted = 0;
+   while (table->keys[slot] != 0){
+      if (table->keys[slot] == key + 1){
+         return slot;
+      }
+      slot = (slot + 1) & table->mask;
+   }
+   table->keys[slot] = key + 1;
+   table->values[slot] = 0;
+   table->count++;
+   *inserted = 1;
+   return slot;
+}
+
+static void block_table_grow(block_table *table){
+   block_table bigger;
+   int inserted;
+   block_table_init(&bigger, table->mask + 1);
+   for (unsigned long long i = 0; i <= table->mask; i++){
+      if (table->keys[i] != 0){
+         unsigned long long slot = block_table_insert(&bigger, table->keys[i] - 1, &inserted);
+         bigger.values[slot] = table->values[i];
+      }
+   }
+   block_table_free(table);
+   *table = bigger;
+}
+
+//remove the entry in slot, shifting later entries of the probe run back (no tombstones)
+void block_table_remove(block_table *table, unsigned long long slot){
+   unsigned long long next = (slot + 1) & table->mask;
+   while (table->keys[next] != 0){
+      unsigned long long home = hash_block(table->keys[next] - 1) & table->mask;
+      //move next into the hole unless its home lies cyclically in (slot, next]
+      if (((next - home) & table->mask) >= ((next - slot) & table->mask)){
+         table->keys[slot] = table->keys[next];
+         table->values[slot] = table->values[next];
+         slot = next;
+      }
+      next = (next + 1) & table->mask;
+   }
+   table->keys[slot] = 0;
+   table->count--;
+}
+
+void lru_table_init(lru_table *table, int capacity){
+   block_table_init(&table->index, capacity);
+   table->keys = (mem_address_tag *) malloc(sizeof(mem_address_tag) * capacity);
+   table->prev = (int *) malloc(sizeof(int) * capacity);
+   table->next = (int *) malloc(sizeof(int) * capacity);
+   table->dirty = (unsigned char *) calloc(capacity, 1);
+   table->head = -1;
+   table->tail = -1;
+   table->used = 0;
+   table->capacity = capacity;
+}
+
+void lru_table_free(lru_table *table){
+   block_table_free(&table->index);
+   free(table->keys);
+   free(table->prev);
+   free(table->next);
+   free(table->dirty);
+}
+
+static inline void lru_table_unlink(lru_table *table, int node){
+   if (table->prev[node] >= 0) table->next[table->prev[node]] = table->next[node];
+   else table->head = table->next[node];
+   if (table->next[node] >= 0) table->prev[table->next[node]] = table->prev[node];
+   else table->tail = table->prev[node];
+}
+
+static inline void lru_table_push_front(lru_table *table, int node){
+   table->prev[node] = -1;
+   table->next[node] = table->head;
+   if (table->head >= 0) table->prev[table->head] = node;
+   table->head = node;
+   if (table->tail < 0) table->tail = node;
+}
+
+//touch key; returns 1 on a hit, 0 on a miss (the key is then inserted as MRU)
+//*evicted is set to 1 when the miss pushed the LRU entry out
+static inline int lru_table_access(lru_table *table, mem_address_tag key, int *evicted){
+   int inserted;
+   unsigned long long slot = block_table_insert(&table->index, key, &inserted);
+   int node;
+
+   *evicted = 0;
+   if (!inserted){
+      node = table->index.values[slot];
+      if (node != table->head){
+         lru_table_unlink(table, node);
+         lru_table_push_front(table, node);
+      }
+      return 1;
+   }
+   if (table->used < table->capacity){
+      node = table->used++;
+   }
+   else {//reuse the LRU node
+      node = table->tail;
+      lru_table_unlink(table, node);
+      table->last_evicted = table->keys[node];
+      table->last_evicted_dirty = table->dirty[node];
+      table->dirty[node] = 0;
+      block_table_remove(&table->index, block_table_find(&table->index, table->keys[node]));
+      slot = block_table_find(&table->index, key); //removal may have shifted key's slot
+      *evicted = 1;
+   }
+   table->keys[node] = key;
+   table->index.values[slot] = node;
+   lru_table_push_front(table, node);
+   return 0;
+}
+
+miss_classifier *create_classifier(long long num_sets, int num_lines){
+   miss_classifier *classifier = (miss_classifier *) malloc(sizeof(miss_classifier));
+   block_table_init(&classifier->seen, 1024);
+   lru_table_init(&classifier->shadow, num_sets * num_lines);
+   return classifier;
+}
+
+//decide what kind of miss an access to block would be, and update the classifier state
+static inline int classify_access(miss_classifier *classifier, mem_address_tag block){
+   int inserted;
+   int evicted;
+   int shadow_hit = lru_table_access(&classifier->shadow, block, &evicted);
+
+   block_table_insert(&classifier->seen, block, &inserted);
+   if (inserted){
+      return MISS_COMPULSORY; //first touch
+   }
+   if (!shadow_hit){
+      return MISS_CAPACITY; //a fully-associative cache of the same size misses too
+   }
+   return MISS_CONFLICT;
+}
+
+
+//backing storage for caches; batch workers keep one and reuse it across jobs
+typedef struct {
+   set_line *lines; //all lines of all sets, set after set
+   long long line_capacity;
+} cache_arena;
+
+//make room for total_lines lines; -1 if the mapping cannot be reserved
+int cache_arena_reserve(cache_arena *arena, long long total_lines){
+   if (total_lines > arena->line_capacity){
+      if (arena->lines != NULL){
+         munmap(arena->lines, sizeof(set_line) * arena->line_capacity);
+      }
+      arena->lines = (set_line *) mmap(NULL, sizeof(set_line) * total_lines, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0); //reserve space for the lines
+      if (arena->lines == MAP_FAILED){
+         arena->lines = NULL;
+         arena->line_capacity = 0;
+         return -1;
+      }
+      arena->line_capacity = total_lines;
+   }
+   else {//reused arena: hand the touched pages back so they read as zero again
+      madvise(arena->lines, sizeof(set_line) * arena->line_capacity, MADV_DONTNEED);
+   }
+   return 0;
+}
+
+//build an empty cache in arena's storage, growing it if this geometry does not fit
+//the lines are a demand-zeroed mapping (all zero = every line invalid), so sets are only
+//materialized when the trace first touches them: startup is O(1) and RSS follows the footprint
+cache create_cache_in(cache_arena *arena, long long num_sets, int num_lines, long long block_size){
+   cache newCache;
+   long long total_lines = num_sets * num_lines;
+   int rank_bits = 0;
+
+   if (cache_arena_reserve(arena, total_lines) != 0){
+      fprintf(stderr, "cannot reserve %lld lines\n", total_lines);
+      exit(1);
+   }
+
+   while ((1 << rank_bits) < num_lines){
+      rank_bits++;
+   }
+   newCache.lines = arena->lines;
+   newCache.num_lines = num_lines;
+   newCache.tag_shift = LINE_FLAG_BITS + rank_bits;
+   newCache.rank_mask = ((1ULL << rank_bits) - 1) << LINE_FLAG_BITS;
+   newCache.sectors = 0;
+   newCache.sector_bits = 0;
+   newCache.sector_shift = newCache.tag_shift;
+   newCache.index_mode = INDEX_BITS;
+   newCache.full_tag = 0;
+   newCache.num_sets = num_sets;
+   newCache.fastmod_M = 0;
+   newCache.matrix_rows = 0;
+   newCache.matrix = NULL;
+   newCache.tlb = NULL;
+   newCache.filter = NULL;
+   newCache.classifier = NULL;
+   newCache.prefetch = NULL;
+   newCache.victim = NULL;
+   newCache.opt = NULL;
+   newCache.timing = NULL;
+   newCache.fa = NULL;
+   newCache.partition = NULL;
+   newCache.wbuf = NULL;
+   newCache.dram = NULL;
+   newCache.track_dirty = 0;
+   return newCache;//return the empty cache
+}
 
 //cache size =  s * E * b
 //using the given values of s(number of sets), E (number of lines per set), and b (block size)
 cache create_cache(long long num_sets, int num_lines, long long block_size){
-   cache newCache;
-   cache_set set;
-   set_line line;
-   int setIndex;
-   int lineIndex;
-
- newCache.sets = (cache_set *) malloc(sizeof(cache_set) * num_sets);//allocate space for sets
+   cache_arena arena = {NULL, 0}; //owned by the new cache from here on
+   return create_cache_in(&arena, num_sets, num_lines, block_size);
+}
 
-   for (setIndex = 0; setIndex < num_sets; setIndex ++){
-      set.lines = (set_line *) malloc(sizeof(set_line) * num_lines); //allocate space for the lines
-      newCache.sets[setIndex] = set;
+//split every line into sectors (a power of two): the valid and dirty bits per sector go
+//between the rank and the tag, so the tag moves up by 2 * sectors bits
+void set_sectors(cache *my_cache, int sectors){
+   my_cache->sectors = sectors;
+   my_cache->sector_bits = __builtin_ctz(sectors);
+   my_cache->sector_shift = my_cache->tag_shift;
+   my_cache->tag_shift += 2 * sectors;
+}
 
-        for(lineIndex = 0; lineIndex < num_lines; lineIndex ++){//initialize all fields to 0
-           line.last_used = 0;
-           line.valid = 0;
-           line.tag = 0;
-           set.lines[lineIndex] = line;
+//attach the hashed fully-associative engine: O(1) lookup and LRU update instead of scanning E lines
+//(the prefetcher fills lines directly, so it keeps the scan path)
+void attach_fa_engine(cache *my_cache){
+   my_cache->fa = (lru_table *) malloc(sizeof(lru_table));
+   lru_table_init(my_cache->fa, my_cache->num_lines);
+}
 
+void detach_fa_engine(cache *my_cache){
+   lru_table_free(my_cache->fa);
+   free(my_cache->fa);
+   my_cache->fa = NULL;
+}
 
-        }
+partition_state *create_partition(long long num_sets, int num_lines, mem_address_tag masks[], int num_tenants){
+   partition_state *partition = (partition_state *) calloc(1, sizeof(partition_state));
+   partition->num_tenants = num_tenants;
+   for (int i = 0; i < num_tenants; i++){
+      partition->masks[i] = masks[i];
+   }
+   partition->owner = (unsigned char *) calloc(num_sets * num_lines, 1);
+   return partition;
+}
 
+//fill target within the tenant's ways: the first empty one, else the least recently used one
+static inline int partition_target(cache *my_cache, cache_set this_set, int numLines, int *cache_filled){
+   mem_address_tag mask = my_cache->partition->masks[my_cache->partition->tenant];
+   int target = -1;
+   unsigned max_rank = 0;
+   for (int i = 0; i < numLines; i++){
+      set_line line = this_set.lines[i];
+      if (((mask >> i) & 1) == 0){
+         continue;
+      }
+      if ((line.bits & LINE_VALID) == 0){
+         *cache_filled = 0;
+         return i;
+      }
+      if (target < 0 || line_rank(my_cache, line) > max_rank){
+         target = i;
+         max_rank = line_rank(my_cache, line);
+      }
    }
-   return newCache;//return the empty cache
+   *cache_filled = 1;
+   return target;
+}
 
+//record the new owner of a line; evicted when the fill replaced a valid line
+static inline void partition_fill(partition_state *partition, long long line, int evicted){
+   int tenant = partition->tenant;
+   if (evicted && partition->owner[line] != tenant){
+      partition->cross_evicts[tenant]++;
+      partition->lost[partition->owner[line]]++;
+   }
+   partition->owner[line] = tenant;
 }
 
 //use the valid tag of a set to see if the line is empty or not
 //when the valid tag = 0, the line is empty
 int find_empty_line(cache_set set, cache_attributes attributes){
-   set_line line;
    int num_lines = attributes.E;
 
    for (int i = 0; i < num_lines; i++){
-      line = set.lines[i];
-      if (line.valid == 0) {
+      if ((set.lines[i].bits & LINE_VALID) == 0) {
         return i; //returns first encountered empty line
       }
 
@@ -85,234 +589,3225 @@ int find_empty_line(cache_set set, cache_attributes attributes){
 
 }
 
-//find and return the index of the least recently used line (LRU)
-int get_LRU (cache_set this_set, cache_attributes attributes, int *used_lines){
+//find and return the index of the least recently used line (LRU): the one with the highest rank
+int get_LRU (cache *my_cache, cache_set this_set, cache_attributes attributes){
    int num_lines = attributes.E;
     int max_LRU_line_index = 0;
-    int max_LRU_count = 0;
+    unsigned max_LRU_rank = 0;
 
     for (int i = 0; i < num_lines; ++i) {//iterate over all lines
-        if (this_set.lines[i].LRU_counter > max_LRU_count) {//find max_LRU
-            max_LRU_count = this_set.lines[i].LRU_counter;
-            max_LRU_line_index = i; //store the index of the current max_LRU
+        unsigned rank = line_rank(my_cache, this_set.lines[i]);
+        if (rank > max_LRU_rank) {//find max rank
+            max_LRU_rank = rank;
+            max_LRU_line_index = i; //store the index of the current max rank
         }
     }
 
    return max_LRU_line_index;//return the index of the least recently used line
 }
 
-                          
-
-
-
-
+//make line index the MRU line: every valid line that was more recent than it (rank below
+//old_rank) ages by one; old_rank = E for a line that was not in the set's order yet
+static inline void promote_line(cache *my_cache, cache_set this_set, int numLines, int index, unsigned old_rank){
+   for (int i = 0; i < numLines; i++){
+        set_line line = this_set.lines[i];
+        if (i != index && (line.bits & LINE_VALID) && line_rank(my_cache, line) < old_rank){
+            this_set.lines[i].bits = line.bits + (1ULL << LINE_FLAG_BITS);
+        }
+   }
+   this_set.lines[index].bits &= ~my_cache->rank_mask;
+}
 
-//run the cache simulation
-cache_attributes simulate_cache (cache my_cache, cache_attributes attributes, mem_address_tag address){
-   int line_index;
-   int cache_filled = 1; //boolean for if cache is completely full
-   int numLines = attributes.E;
-   int previous_hits = attributes.hits;
-   int tag_size = (64 - (attributes.s + attributes.b));// tag_size = 64 - s - b
+//Lemire's fastmod: a % d for 32-bit a with one multiply chain instead of a divide
+static inline unsigned fastmod_u32(unsigned a, unsigned long long M, unsigned d){
+   unsigned long long lowbits = M * a;
+   return (unsigned) (((__uint128_t) lowbits * d) >> 64);
+}
 
-   unsigned long long temp = address << (tag_size);
-   unsigned long long set_index = temp >> (tag_size + attributes.b);
-   mem_address_tag input_tag = address >> (attributes.s + attributes.b);
+//pick the index function and set count; num_sets need not be a power of 2
+void set_index_function(cache *my_cache, int mode, unsigned long long num_sets, mem_address_tag *matrix, int matrix_rows){
+   my_cache->index_mode = mode;
+   my_cache->num_sets = num_sets;
+   my_cache->full_tag = (mode != INDEX_BITS) || (num_sets & (num_sets - 1)) != 0;
+   my_cache->fastmod_M = 0xFFFFFFFFFFFFFFFFULL / num_sets + 1;
+   my_cache->matrix_rows = matrix_rows;
+   my_cache->matrix = (mem_address_tag *) malloc((matrix_rows > 0 ? matrix_rows : 1) * sizeof(mem_address_tag));
+   for (int i = 0; i < matrix_rows; i++){
+      my_cache->matrix[i] = matrix[i];
+   }
+}
 
-   cache_set this_set = my_cache.sets[set_index];
+//set index of a block for the non bit-slice index functions
+static inline unsigned long long hashed_index(cache *my_cache, mem_address_tag block){
+   unsigned long long num_sets = my_cache->num_sets;
+   int pow2 = (num_sets & (num_sets - 1)) == 0;
+   mem_address_tag h;
 
-   for (line_index = 0; line_index < numLines; line_index++){
-        set_line this_line = this_set.lines[line_index];
-        if(this_line.valid){
-            if (this_line.tag == input_tag){
-                attributes.hits++;//it's a hit
-                //increase the LRU_counter of all the other lines
-                //reset the current line's LRU_counter to 0
-                for (int i = 0; i < numLines; i++){
-                    if (my_cache.sets[set_index].lines[i].valid){
-                        my_cache.sets[set_index].lines[i].LRU_counter++;
-                    }
-                }
-                my_cache.sets[set_index].lines[line_index].LRU_counter = 0; //reset current LRU_counter to 0
-                // this_line.last_used++;
-                // attributes.hits++;
-                // this_set.lines[line_index] = this_line;
-            }
-        }
-        else{// if (!(this_line.valid) && (cache_filled))
-            cache_filled = 0; //set cache filled equal to false; there must be an empty line
-        }
+   if (my_cache->index_mode == INDEX_XOR){
+      if (pow2){
+         int bits = __builtin_ctzll(num_sets);
+         h = 0;
+         for (; block != 0 && bits > 0; block >>= bits){
+            h ^= block;
+         }
+         return h & (num_sets - 1);
+      }
+      int bits = 64 - __builtin_clzll(num_sets - 1); //ceil(log2 num_sets): fold the whole block into that many bits
+      h = 0;
+      for (; block != 0; block >>= bits){
+         h ^= block & ((1ULL << bits) - 1);
+      }
    }
+   else if (my_cache->index_mode == INDEX_MATRIX){
+      h = 0;
+      for (int i = 0; i < my_cache->matrix_rows; i++){
+         h |= (mem_address_tag) __builtin_parityll(block & my_cache->matrix[i]) << i;
+      }
+   }
+   else {
+      h = block;
+   }
+   if (pow2){
+      return h & (num_sets - 1);
+   }
+   return fastmod_u32((unsigned) h, my_cache->fastmod_M, (unsigned) num_sets);
+}
 
-   if (previous_hits == attributes.hits){//hits was not incremented, so it must have been a cache miss
-        attributes.misses++; //Increment the misses
+//split a block address into set index and stored tag
+static inline void locate_block(cache *my_cache, int s, mem_address_tag block, unsigned long long *set_index, mem_address_tag *tag){
+   if (!my_cache->full_tag){
+      *set_index = block & ((1ULL << s) - 1);
+      *tag = block >> s;
    }
    else {
-    return attributes; //there was already a hit and the data is already in the cache
+      *set_index = hashed_index(my_cache, block);
+      *tag = block;
    }
+}
 
+//inverse of locate_block: the block address held by a line
+static inline mem_address_tag line_block(cache *my_cache, int s, mem_address_tag tag, unsigned long long set_index){
+   return my_cache->full_tag ? tag : ((tag << s) | set_index);
+}
 
-   //there was not a hit->so it must have been a miss.
-   // Evict by ge
-   int *used_lines = (int*) malloc(sizeof (int) * 2);
-   int indexOf_least_used = get_LRU(this_set, attributes, used_lines);
+run_filter *create_run_filter(int size){
+   run_filter *filter = (run_filter *) calloc(1, sizeof(run_filter));
+   filter->size = (size > RUN_FILTER_MAX) ? RUN_FILTER_MAX : size;
+   return filter;
+}
 
-   if (cache_filled){//if the cache is full, we'll need to ovwe
-        attributes.evicts++;
-        //figure out which one to evict 
-        //write and replace LRU; update this
-        this_set.lines[indexOf_least_used].tag = input_tag;
-        for (int i = 0; i < numLines; i++){
-            if (this_set.lines[i].valid){
-                this_set.lines[i].LRU_counter++;
-            }
-        }
-        this_set.lines[indexOf_least_used].LRU_counter = 0; //reset current LRU_counter to 0
+static inline int run_filter_hit(run_filter *filter, mem_address_tag block){
+   for (int i = 0; i < filter->size; i++){
+      if (filter->blocks[i] == block + 1){
+         return 1;
+      }
    }
-   else { //there is at least one empty line that we can use: write to it.
-        int indexOf_empty_line = find_empty_line(this_set, attributes);
-        // update valid/ tag bits with the input cache's at the empty line 
-        this_set.lines[indexOf_empty_line].tag = input_tag; //tag bits
-        this_set.lines[indexOf_empty_line].valid = 1; //valid bit
-        for (int i = 0; i < numLines; i++){
-            if (this_set.lines[i].valid){
-                this_set.lines[i].LRU_counter++;
-            }
-        }
-        this_set.lines[indexOf_least_used].LRU_counter = 0; //reset current LRU_counter to 0
+   return 0;
+}
+
+//drop every entry for set_index; called whenever something changes that set's order
+static inline void run_filter_forget(run_filter *filter, unsigned long long set_index){
+   for (int i = 0; i < filter->size; i++){
+      if (filter->sets[i] == set_index){
+         filter->blocks[i] = 0;
+      }
    }
-   free(used_lines);
-   return attributes;
-} //end of simulate_cache
+}
 
+//block has just become the MRU line of set_index
+static inline void run_filter_record(run_filter *filter, mem_address_tag block, unsigned long long set_index){
+   run_filter_forget(filter, set_index);
+   filter->blocks[filter->next] = block + 1;
+   filter->sets[filter->next] = set_index;
+   filter->next = (filter->next + 1 == filter->size) ? 0 : filter->next + 1;
+}
 
-int count_lines(char *filename, int *numLines){
+#define DRAM_MAX_QUEUE 64
 
-   FILE *file = fopen(filename, "r");
+//one memory request waiting in a channel queue
+typedef struct {
+   long long row;
+   int bank; //rank * banks + bank within the channel
+   int bytes;
+   int write;
+} dram_request;
 
-   char buff[25];
-   char *line = fgets(buff, 25, file);
+//DRAM behind the cache: addresses map as row:rank:bank:channel:column, each bank keeps one
+//open row, and each channel serves its queue FR-FCFS-lite: when the queue is full, the oldest
+//request that hits an open row goes first, else the oldest request
+typedef struct dram_model {
+   int block_bits; //requests arrive as block numbers
+   int column_bits; //log2 row size in bytes
+   int channel_bits;
+   int bank_bits;
+   int rank_bits;
+   int open_page; //0 = closed page: a row closes unless a queued request still wants it
+   int queue_size;
 
-   int count;
-   while (line){
-      if (line[0] != 'I'){
-        count++;
+   long long *open_row; //per channel, rank and bank; -1 = precharged
+   dram_request *queue; //queue_size requests per channel, oldest first
+   int *queued;
+
+   long long row_hits;
+   long long row_misses; //bank had no open row
+   long long row_conflicts; //bank had another row open
+   long long reordered; //requests served ahead of an older one
+   long long *bytes_read; //per channel
+   long long *bytes_written;
+} dram_model;
+
+static int log2_exact(int value){
+   return (value > 0 && (value & (value - 1)) == 0) ? __builtin_ctz(value) : -1;
+}
+
+//spec: comma-separated name=value pairs, e.g. "channels=2,banks=8,row=8192,policy=closed,queue=16"
+dram_model *create_dram(char *spec, int b){
+   int channels = 1, ranks = 1, banks = 8, row = 8192, queue = 16;
+   int open_page = 1;
+   while (spec != NULL && *spec != '\0'){
+      char name[16];
+      char value[16];
+      int used = 0;
+      if (sscanf(spec, "%15[^=]=%15[^,]%n", name, value, &used) != 2){
+         return NULL;
       }
-      line = fgets(buff, 25, file);
+      if (strcmp(name, "channels") == 0) channels = atoi(value);
+      else if (strcmp(name, "ranks") == 0) ranks = atoi(value);
+      else if (strcmp(name, "banks") == 0) banks = atoi(value);
+      else if (strcmp(name, "row") == 0) row = atoi(value);
+      else if (strcmp(name, "queue") == 0) queue = atoi(value);
+      else if (strcmp(name, "policy") == 0 && strcmp(value, "open") == 0) open_page = 1;
+      else if (strcmp(name, "policy") == 0 && strcmp(value, "closed") == 0) open_page = 0;
+      else return NULL;
+      spec += used;
+      if (*spec == ',') spec++;
    }
-   *numLines = count;
-   return 0;
+   if (log2_exact(channels) < 0 || log2_exact(ranks) < 0 || log2_exact(banks) < 0 || log2_exact(row) < b
+       || queue < 1 || queue > DRAM_MAX_QUEUE){
+      return NULL;
+   }
+   dram_model *dram = (dram_model *) calloc(1, sizeof(dram_model));
+   dram->block_bits = b;
+   dram->column_bits = log2_exact(row);
+   dram->channel_bits = log2_exact(channels);
+   dram->bank_bits = log2_exact(banks);
+   dram->rank_bits = log2_exact(ranks);
+   dram->open_page = open_page;
+   dram->queue_size = queue;
+   dram->open_row = (long long *) malloc(sizeof(long long) * channels * ranks * banks);
+   for (int i = 0; i < channels * ranks * banks; i++){
+      dram->open_row[i] = -1;
+   }
+   dram->queue = (dram_request *) calloc((size_t) channels * queue, sizeof(dram_request));
+   dram->queued = (int *) calloc(channels, sizeof(int));
+   dram->bytes_read = (long long *) calloc(channels, sizeof(long long));
+   dram->bytes_written = (long long *) calloc(channels, sizeof(long long));
+   return dram;
 }
 
-//method to read and parse the trace file
-int read_file(char *filename, char operations[], long memAddresses[], int sizes[]){
-   FILE *file = fopen(filename, "r");
-   char buff[25];
-   char operation;
-   long mem_address;
-   int size;
+//serve one request from a channel queue
+static void dram_schedule(dram_model *dram, int channel){
+   dram_request *queue = dram->queue + (long long) channel * dram->queue_size;
+   long long *open_row = dram->open_row + ((long long) channel << (dram->rank_bits + dram->bank_bits));
+   int pick = 0;
+   for (int i = 0; i < dram->queued[channel]; i++){//first ready: the oldest row hit
+      if (open_row[queue[i].bank] == queue[i].row){
+         pick = i;
+         break;
+      }
+   }
+   dram_request request = queue[pick];
+   if (pick > 0){
+      dram->reordered++;
+   }
+   if (open_row[request.bank] == request.row) dram->row_hits++;
+   else if (open_row[request.bank] < 0) dram->row_misses++;
+   else dram->row_conflicts++;
+   if (request.write) dram->bytes_written[channel] += request.bytes;
+   else dram->bytes_read[channel] += request.bytes;
 
-   char *line = fgets(buff, 25, file);
+   dram->queued[channel]--;
+   for (int i = pick; i < dram->queued[channel]; i++){
+      queue[i] = queue[i + 1];
+   }
+   open_row[request.bank] = request.row;
+   if (!dram->open_page){//closed page: precharge unless a queued request wants this row
+      int wanted = 0;
+      for (int i = 0; i < dram->queued[channel]; i++){
+         wanted |= queue[i].bank == request.bank && queue[i].row == request.row;
+      }
+      if (!wanted){
+         open_row[request.bank] = -1;
+      }
+   }
+}
 
-int counter = 0;
-   while (line){
-      if (line[0] != 'I'){
-        sscanf(line, " %c %lx,%u", &operation, &mem_address, &size);
-        operations[counter] = operation;
-        memAddresses[counter] = mem_address;
-        sizes[counter] = size;
-        counter++;
+static void dram_access(dram_model *dram, mem_address_tag block, int write, int bytes){
+   mem_address_tag above = (block << dram->block_bits) >> dram->column_bits;
+   int channel = above & ((1 << dram->channel_bits) - 1);
+   above >>= dram->channel_bits;
+   if (dram->queued[channel] == dram->queue_size){
+      dram_schedule(dram, channel);
+   }
+   dram_request *request = dram->queue + (long long) channel * dram->queue_size + dram->queued[channel];
+   request->bank = above & ((1 << (dram->bank_bits + dram->rank_bits)) - 1);
+   request->row = above >> (dram->bank_bits + dram->rank_bits);
+   request->bytes = bytes;
+   request->write = write;
+   dram->queued[channel]++;
+}
+
+//serve everything still queued and print the row-buffer and traffic counts
+void print_dram(dram_model *dram){
+   for (int channel = 0; channel < (1 << dram->channel_bits); channel++){
+      while (dram->queued[channel] > 0){
+         dram_schedule(dram, channel);
       }
-      line = fgets(buff, 25, file);
    }
-   return 0;
+   printf("dram row hits:%lld misses:%lld conflicts:%lld reordered:%lld\n", dram->row_hits, dram->row_misses,
+          dram->row_conflicts, dram->reordered);
+   for (int channel = 0; channel < (1 << dram->channel_bits); channel++){
+      printf("dram channel %d read bytes:%lld written bytes:%lld\n", channel, dram->bytes_read[channel],
+             dram->bytes_written[channel]);
+   }
 }
 
+#define DRAIN_FULL 0 //drain the oldest entry when a new one needs its slot
+#define DRAIN_WATERMARK 1 //once full, drain the oldest entries down to half
+#define DRAIN_PERIODIC 2 //also drain the oldest entry every period accesses
 
-/* main takes in command line inputs and prints the cache hits, misses, and evictions */
-int main(int argc, char **argv)
-{
-    char *tracefile; //the name of the file to be traced
-    tracefile = (argv[argc-1]); //name is the last input provided via command line
+//coalescing write buffer between the cache and memory: dirty evictions wait here, a later
+//writeback of the same block merges into its entry, and loads that miss the cache can be
+//served from it; memory only sees the entries as they drain
+typedef struct write_buffer {
+   mem_address_tag *blocks; //block address + 1; 0 marks an empty entry
+   unsigned *dirty; //dirty units held: sectors, or bit 0 for a whole line
+   long long *stamps; //allocation order, so the oldest entry drains first
+   int entries;
+   int used;
+   int policy;
+   int period; //accesses between drains for DRAIN_PERIODIC
+   int unit_bytes; //bytes per dirty unit
+   long long clock; //allocations, then accesses for DRAIN_PERIODIC
+   long long accesses;
 
-    /*count the number of non-'I' operation lines in the input file;*/
-    int numLines;
-    count_lines(tracefile, &numLines);
+   long long writebacks; //dirty lines handed over by the cache
+   long long merged; //writebacks that coalesced into a buffered entry
+   long long load_hits; //loads that missed the cache and found their block here
+   long long bytes_in; //bytes the writebacks carried: the memory traffic without a buffer
+   long long bytes_out; //bytes drained to memory
+   dram_model *dram; //where drained entries go, NULL when memory is not modelled
+} write_buffer;
 
-    /*arrays to store the operation, memory address and size of each entry*/
-    char operations[numLines]; 
-    long memAddresses[numLines];
-    int sizes[numLines];
+write_buffer *create_write_buffer(int entries, int policy, int period){
+   write_buffer *wbuf = (write_buffer *) calloc(1, sizeof(write_buffer));
+   wbuf->entries = entries;
+   wbuf->policy = policy;
+   wbuf->period = (period < 1) ? 1 : period;
+   wbuf->blocks = (mem_address_tag *) calloc(entries, sizeof(mem_address_tag));
+   wbuf->dirty = (unsigned *) calloc(entries, sizeof(unsigned));
+   wbuf->stamps = (long long *) calloc(entries, sizeof(long long));
+   return wbuf;
+}
 
-    /*read in file and store info to arrays*/
-    read_file(tracefile, operations, memAddresses, sizes);
+static inline int write_buffer_find(write_buffer *wbuf, mem_address_tag block){
+   for (int i = 0; i < wbuf->entries; i++){
+      if (wbuf->blocks[i] == block + 1){
+         return i;
+      }
+   }
+   return -1;
+}
 
-    cache this_cache; //initialize a cache
-    cache_attributes attributes; //initialize cache_attributes
+//write the oldest entry to memory
+static void write_buffer_drain(write_buffer *wbuf){
+   int oldest = -1;
+   for (int i = 0; i < wbuf->entries; i++){
+      if (wbuf->blocks[i] != 0 && (oldest < 0 || wbuf->stamps[i] < wbuf->stamps[oldest])){
+         oldest = i;
+      }
+   }
+   if (oldest >= 0){
+      wbuf->bytes_out += (long long) __builtin_popcount(wbuf->dirty[oldest]) * wbuf->unit_bytes;
+      if (wbuf->dram != NULL){
+         dram_access(wbuf->dram, wbuf->blocks[oldest] - 1, 1, __builtin_popcount(wbuf->dirty[oldest]) * wbuf->unit_bytes);
+      }
+      wbuf->blocks[oldest] = 0;
+      wbuf->dirty[oldest] = 0;
+      wbuf->used--;
+   }
+}
 
-    long long num_sets;
-    long long block_size;
+static void write_buffer_insert(write_buffer *wbuf, mem_address_tag block, unsigned dirty, int unit_bytes){
+   int entry = write_buffer_find(wbuf, block);
+   wbuf->writebacks++;
+   wbuf->unit_bytes = unit_bytes;
+   wbuf->bytes_in += (long long) __builtin_popcount(dirty) * unit_bytes;
+   if (entry >= 0){
+      wbuf->dirty[entry] |= dirty;
+      wbuf->merged++;
+      return;
+   }
+   if (wbuf->used == wbuf->entries){
+      int keep = (wbuf->policy == DRAIN_WATERMARK) ? wbuf->entries / 2 : wbuf->entries - 1;
+      while (wbuf->used > keep){
+         write_buffer_drain(wbuf);
+      }
+   }
+   entry = write_buffer_find(wbuf, (mem_address_tag) -1); //an empty entry (key 0)
+   wbuf->blocks[entry] = block + 1;
+   wbuf->dirty[entry] = dirty;
+   wbuf->stamps[entry] = ++wbuf->clock;
+   wbuf->used++;
+}
 
-    FILE *read_trace;
+//send dirty units of block to the write buffer, or straight to DRAM
+static void write_back_block(cache *my_cache, cache_attributes *attributes, mem_address_tag block, unsigned dirty,
+                             int unit_bytes){
+   attributes->writebacks += __builtin_popcount(dirty);
+   if (my_cache->wbuf != NULL){
+      write_buffer_insert(my_cache->wbuf, block, dirty, unit_bytes);
+   }
+   else if (my_cache->dram != NULL){
+      dram_access(my_cache->dram, block, 1, __builtin_popcount(dirty) * unit_bytes);
+   }
+}
 
-    char *trace_file;
-    char c;
-    /*parse the command line args*/
-    while( (c=getopt(argc,argv,"s:E:b:t:vh")) != -1){
-        switch(c){
-        case 's':
-            attributes.s = atoi(optarg);
-            break;
-        case 'E':
-            attributes.E = atoi(optarg);
-            break;
-        case 'b':
-            attributes.b = atoi(optarg);
+//a line leaves the cache: count its dirty units and hand them to the write buffer, if any
+static void write_back(cache *my_cache, cache_attributes *attributes, set_line line, unsigned long long set_index){
+   unsigned dirty;
+   int unit_bytes = 1 << attributes->b;
+   if (my_cache->sectors > 0){
+      dirty = (line.bits >> (my_cache->sector_shift + my_cache->sectors)) & ((1u << my_cache->sectors) - 1);
+      unit_bytes >>= my_cache->sector_bits;
+   }
+   else {
+      dirty = (line.bits & LINE_DIRTY) ? 1 : 0;
+   }
+   if (dirty == 0){
+      return;
+   }
+   write_back_block(my_cache, attributes, line_block(my_cache, attributes->s, line_tag(my_cache, line), set_index), dirty, unit_bytes);
+}
+
+//flush whatever is still buffered and print the traffic with and without coalescing
+void print_write_buffer(write_buffer *wbuf){
+   while (wbuf->used > 0){
+      write_buffer_drain(wbuf);
+   }
+   printf("write buffer writebacks:%lld merged:%lld load hits:%lld\n", wbuf->writebacks, wbuf->merged, wbuf->load_hits);
+   printf("bytes to memory before coalescing:%lld after:%lld\n", wbuf->bytes_in, wbuf->bytes_out);
+}
+
+prefetcher *create_prefetcher(int kind, int degree, int distance, int latency){
+   prefetcher *pf = (prefetcher *) calloc(1, sizeof(prefetcher));
+   pf->kind = kind;
+   pf->degree = degree;
+   pf->distance = distance;
+   pf->latency = latency;
+   block_table_init(&pf->polluted, 1024);
+   return pf;
+}
+
+//install block as a prefetched line (MRU) unless it is already cached
+static inline int victim_find(victim_cache *victim, mem_address_tag block);
+static inline void victim_insert(victim_cache *victim, mem_address_tag block, int entry);
+
+void prefetch_fill(cache my_cache, cache_attributes *attributes, mem_address_tag block){
+   unsigned long long set_index;
+   mem_address_tag input_tag;
+   locate_block(&my_cache, attributes->s, block, &set_index, &input_tag);
+   cache_set this_set = cache_set_at(&my_cache, set_index);
+   int numLines = attributes->E;
+   int target = -1;
+   unsigned old_rank = numLines;
+   long long slot;
+
+   for (int i = 0; i < numLines; i++){
+        if (this_set.lines[i].bits & LINE_VALID){
+            if (line_tag(&my_cache, this_set.lines[i]) == input_tag){
+                return; //already present, nothing to do
+            }
+        }
+        else if (target < 0){
+            target = i;
+        }
+   }
+   attributes->pf_issued++;
+   int victim_slot = (my_cache.victim != NULL) ? victim_find(my_cache.victim, block) : -1; //fetched from there, not memory
+   if (my_cache.dram != NULL && victim_slot < 0){
+        dram_access(my_cache.dram, block, 0, 1 << attributes->b);
+   }
+   if (my_cache.filter != NULL){//the fill becomes the set's MRU line
+        run_filter_forget(my_cache.filter, set_index);
+   }
+   slot = block_table_find(&my_cache.prefetch->polluted, block);
+   if (slot >= 0){
+        block_table_remove(&my_cache.prefetch->polluted, slot);
+   }
+   if (target < 0){//no empty line: the prefetch displaces the LRU line
+        int inserted;
+        target = get_LRU(&my_cache, this_set, *attributes);
+        old_rank = line_rank(&my_cache, this_set.lines[target]);
+        mem_address_tag displaced = line_block(&my_cache, attributes->s, line_tag(&my_cache, this_set.lines[target]), set_index);
+        write_back(&my_cache, attributes, this_set.lines[target], set_index);
+        block_table_insert(&my_cache.prefetch->polluted, displaced, &inserted);
+        if (my_cache.victim != NULL){//like a demand eviction: the displaced line goes to the victim cache
+            victim_insert(my_cache.victim, displaced, victim_slot);
+        }
+   }
+   else if (victim_slot >= 0){//the block moves back into the cache
+        my_cache.victim->blocks[victim_slot] = 0;
+        my_cache.victim->stamps[victim_slot] = 0;
+   }
+   this_set.lines[target].bits = (input_tag << my_cache.tag_shift) | (this_set.lines[target].bits & my_cache.rank_mask) | LINE_PREFETCHED | LINE_VALID;
+   promote_line(&my_cache, this_set, numLines, target, old_rank);
+}
+
+//fill now, or queue the prefetch until its latency has passed
+static void prefetch_issue(cache my_cache, cache_attributes *attributes, mem_address_tag block){
+   prefetcher *pf = my_cache.prefetch;
+   if (pf->latency == 0){
+        prefetch_fill(my_cache, attributes, block);
+        return;
+   }
+   for (int i = 0; i < pf->num_pending; i++){
+        if (pf->pending[i] == block){
+            return;
+        }
+   }
+   if (pf->num_pending < PREFETCH_QUEUE){//a full queue drops the request
+        pf->pending[pf->num_pending] = block;
+        pf->ready[pf->num_pending] = pf->now + pf->latency;
+        pf->num_pending++;
+   }
+}
+
+//land the in-flight prefetches that are due
+static void prefetch_drain(cache my_cache, cache_attributes *attributes){
+   prefetcher *pf = my_cache.prefetch;
+   int kept = 0;
+   for (int i = 0; i < pf->num_pending; i++){
+        if (pf->ready[i] <= pf->now){
+            prefetch_fill(my_cache, attributes, pf->pending[i]);
+        }
+        else {
+            pf->pending[kept] = pf->pending[i];
+            pf->ready[kept] = pf->ready[i];
+            kept++;
+        }
+   }
+   pf->num_pending = kept;
+}
+
+//account for a demand miss on block: was it late, or caused by a polluting prefetch?
+static void prefetch_check_miss(prefetcher *pf, cache_attributes *attributes, mem_address_tag block){
+   long long slot;
+   for (int i = 0; i < pf->num_pending; i++){
+        if (pf->pending[i] == block){
+            attributes->pf_late++;
+            pf->num_pending--;
+            pf->pending[i] = pf->pending[pf->num_pending];
+            pf->ready[i] = pf->ready[pf->num_pending];
+            break;
+        }
+   }
+   slot = block_table_find(&pf->polluted, block);
+   if (slot >= 0){
+        attributes->pf_polluting++;
+        block_table_remove(&pf->polluted, slot);
+   }
+}
+
+//train on one demand access and issue whatever the predictor asks for
+//trigger is set for demand misses and for the first hit on a prefetched line
+static void prefetch_train(cache my_cache, cache_attributes *attributes, mem_address_tag block, int trigger){
+   prefetcher *pf = my_cache.prefetch;
+   long long stride = 0;
+
+   if (pf->kind == PREFETCH_NEXT_LINE){
+        if (trigger){
+            stride = 1;
+        }
+   }
+   else if (pf->kind == PREFETCH_STRIDE){//global address-delta detector, no PC
+        long long delta = (long long) (block - pf->last_block);
+        if (delta == 0){
+            return; //same block again, nothing to learn
+        }
+        if (delta == pf->last_stride){
+            if (pf->confidence < 3) pf->confidence++;
+        }
+        else {
+            pf->confidence = 0;
+        }
+        pf->last_stride = delta;
+        pf->last_block = block;
+        if (pf->confidence >= 2){
+            stride = delta;
+        }
+   }
+   else if (trigger){//stream: misses walking through nearby blocks in one direction
+        prefetch_stream *match = NULL;
+        prefetch_stream *oldest = &pf->streams[0];
+        for (int i = 0; i < PREFETCH_STREAMS; i++){
+            prefetch_stream *st = &pf->streams[i];
+            long long delta = (long long) (block - st->last_block);
+            if (st->last_used > 0 && delta != 0 && delta <= PREFETCH_WINDOW && delta >= -PREFETCH_WINDOW
+                && (st->direction == 0 || (delta > 0) == (st->direction > 0))){
+                match = st;
+                break;
+            }
+            if (st->last_used < oldest->last_used){
+                oldest = st;
+            }
+        }
+        if (match == NULL){//start a new stream in the least recently used slot
+            oldest->last_block = block;
+            oldest->direction = 0;
+            oldest->confidence = 0;
+            oldest->last_used = pf->now;
+            return;
+        }
+        match->direction = (block > match->last_block) ? 1 : -1;
+        if (match->confidence < 3) match->confidence++;
+        match->last_block = block;
+        match->last_used = pf->now;
+        if (match->confidence >= 2){
+            stride = match->direction;
+        }
+   }
+
+   for (int k = 0; stride != 0 && k < pf->degree; k++){
+        prefetch_issue(my_cache, attributes, block + stride * (pf->distance + k));
+   }
+}
+
+
+cache_attributes simulate_cache (cache my_cache, cache_attributes attributes, mem_address_tag address, int is_write);
+
+//page-table levels touched by a walk: 4 for 4K pages, 3 for 2M, 2 for 1G
+static inline int walk_levels(int page_bits){
+   return 4 - (page_bits - 12) / 9;
+}
+
+//set up the TLB levels from "s,E" geometries; stlb/pwc may be NULL to leave that level out
+tlb_model *create_tlb(int page_bits, int dtlb_s, int dtlb_E, int stlb_s, int stlb_E, int pwc_s, int pwc_E){
+   tlb_model *tlb = (tlb_model *) calloc(1, sizeof(tlb_model));
+   tlb->page_bits = page_bits;
+
+   tlb->dtlb = create_cache(1LL << dtlb_s, dtlb_E, 1LL << page_bits);
+   tlb->dtlb_stats.s = dtlb_s;
+   tlb->dtlb_stats.E = dtlb_E;
+   tlb->dtlb_stats.b = page_bits;
+
+   tlb->use_stlb = stlb_E > 0;
+   if (tlb->use_stlb){
+      tlb->stlb = create_cache(1LL << stlb_s, stlb_E, 1LL << page_bits);
+      tlb->stlb_stats.s = stlb_s;
+      tlb->stlb_stats.E = stlb_E;
+      tlb->stlb_stats.b = page_bits;
+   }
+
+   tlb->use_pwc = pwc_E > 0;
+   for (int level = 0; tlb->use_pwc && level < walk_levels(page_bits) - 1; level++){
+      int entry_bits = page_bits + 9 * (level + 1); //bytes mapped by one entry at this level
+      tlb->pwc[level] = create_cache(1LL << pwc_s, pwc_E, 1LL << entry_bits);
+      tlb->pwc_stats[level].s = pwc_s;
+      tlb->pwc_stats[level].E = pwc_E;
+      tlb->pwc_stats[level].b = entry_bits;
+   }
+   return tlb;
+}
+
+//translate one virtual address: DTLB, then STLB, then a page walk
+void tlb_translate(tlb_model *tlb, mem_address_tag address){
+   int previous_hits = tlb->dtlb_stats.hits;
+   tlb->dtlb_stats = simulate_cache(tlb->dtlb, tlb->dtlb_stats, address, 0);
+   if (tlb->dtlb_stats.hits != previous_hits){
+      return;
+   }
+   if (tlb->use_stlb){
+      previous_hits = tlb->stlb_stats.hits;
+      tlb->stlb_stats = simulate_cache(tlb->stlb, tlb->stlb_stats, address, 0);
+      if (tlb->stlb_stats.hits != previous_hits){
+         return;
+      }
+   }
+
+   int levels = walk_levels(tlb->page_bits);
+   int refs = levels;
+   tlb->walks++;
+   if (tlb->use_pwc){//the deepest cached upper-level entry decides where the walk starts
+      for (int level = levels - 2; level >= 0; level--){
+         previous_hits = tlb->pwc_stats[level].hits;
+         tlb->pwc_stats[level] = simulate_cache(tlb->pwc[level], tlb->pwc_stats[level], address, 0);
+         if (tlb->pwc_stats[level].hits != previous_hits){
+            refs = level + 1;
+         }
+      }
+   }
+   tlb->walk_refs += refs;
+}
+
+victim_cache *create_victim_cache(int entries){
+   victim_cache *victim = (victim_cache *) malloc(sizeof(victim_cache));
+   victim->entries = (entries + 3) & ~3; //pad to a multiple of 4 so the probe has no scalar tail
+   victim->blocks = (mem_address_tag *) calloc(victim->entries, sizeof(mem_address_tag));
+   victim->stamps = (unsigned *) calloc(victim->entries, sizeof(unsigned));
+   for (int i = entries; i < victim->entries; i++){
+      victim->stamps[i] = ~0u; //padding entries are never chosen for replacement
+   }
+   victim->clock = 0;
+   return victim;
+}
+
+//return the entry holding block, or -1; no early exit so the compare loop vectorizes
+static inline int victim_find(victim_cache *victim, mem_address_tag block){
+   mem_address_tag key = block + 1;
+   int found = -1;
+   for (int i = 0; i < victim->entries; i++){
+      found = (victim->blocks[i] == key) ? i : found;
+   }
+   return found;
+}
+
+//store an evicted block in entry, or in the LRU entry when entry is -1
+static inline void victim_insert(victim_cache *victim, mem_address_tag block, int entry){
+   if (entry < 0){
+      entry = 0;
+      for (int i = 1; i < victim->entries; i++){
+         if (victim->stamps[i] < victim->stamps[entry]){
+            entry = i;
+         }
+      }
+   }
+   victim->blocks[entry] = block + 1;
+   victim->stamps[entry] = ++victim->clock;
+}
+
+
+#define MAX_MSHRS 64
+#define LATENCY_BUCKETS 16 //power-of-two latency histogram
+
+//cycle-approximate timing around the functional cache: one access issues per cycle, misses
+//hold an MSHR until memory answers, and later accesses to that block merge into it
+typedef struct timing_model {
+   int l1_latency; //per-level latencies, in cycles
+   int victim_latency; //extra on a victim cache hit
+   int memory_latency; //extra on a miss
+   int stlb_latency; //extra when the DTLB misses and the STLB hits
+   int walk_latency; //extra per page-walk memory reference
+   int num_mshrs;
+
+   mem_address_tag mshr_block[MAX_MSHRS]; //outstanding misses
+   unsigned long long mshr_ready[MAX_MSHRS]; //cycle each one completes
+   int outstanding;
+
+   unsigned long long now; //issue cycle of the next access
+   unsigned long long finish; //completion of the latest access so far
+   unsigned long long total_latency;
+   long long accesses;
+   unsigned long long mshr_stalls; //issue cycles lost to full MSHRs
+   long long merged; //accesses that waited on an outstanding miss
+   long long mlp_sum; //outstanding misses, sampled at each new miss
+   long long mlp_samples;
+   int max_outstanding;
+   long long histogram[LATENCY_BUCKETS];
+} timing_model;
+
+timing_model *create_timing(char *spec, int num_mshrs){
+   timing_model *timing = (timing_model *) calloc(1, sizeof(timing_model));
+   timing->l1_latency = 4;
+   timing->victim_latency = 2;
+   timing->memory_latency = 100;
+   timing->stlb_latency = 7;
+   timing->walk_latency = 20;
+   timing->num_mshrs = (num_mshrs < 1) ? 1 : (num_mshrs > MAX_MSHRS) ? MAX_MSHRS : num_mshrs;
+
+   //spec: comma-separated level=cycles pairs, e.g. "l1=4,mem=200"
+   while (spec != NULL && *spec != '\0'){
+      char name[16];
+      int cycles;
+      int used = 0;
+      if (sscanf(spec, "%15[^=]=%d%n", name, &cycles, &used) != 2){
+         return NULL;
+      }
+      if (strcmp(name, "l1") == 0) timing->l1_latency = cycles;
+      else if (strcmp(name, "victim") == 0) timing->victim_latency = cycles;
+      else if (strcmp(name, "mem") == 0) timing->memory_latency = cycles;
+      else if (strcmp(name, "stlb") == 0) timing->stlb_latency = cycles;
+      else if (strcmp(name, "walk") == 0) timing->walk_latency = cycles;
+      else return NULL;
+      spec += used;
+      if (*spec == ',') spec++;
+   }
+   return timing;
+}
+
+void print_timing(timing_model *timing){
+   unsigned long long cycles = (timing->finish > timing->now) ? timing->finish : timing->now;
+   printf("amat:%.2f cycles:%llu stall cycles:%llu mshr stalls:%llu merged:%lld\n",
+          timing->accesses ? (double) timing->total_latency / timing->accesses : 0.0,
+          cycles, cycles - timing->accesses, timing->mshr_stalls, timing->merged);
+   printf("mlp avg:%.2f max:%d\n", timing->mlp_samples ? (double) timing->mlp_sum / timing->mlp_samples : 0.0,
+          timing->max_outstanding);
+   printf("latency histogram:");
+   for (int k = 0; k < LATENCY_BUCKETS; k++){
+      if (timing->histogram[k] > 0){
+         printf(" [%llu,%llu):%lld", 1ULL << k, 2ULL << k, timing->histogram[k]);
+      }
+   }
+   printf("\n");
+}
+
+#define OPT_NEVER 0xFFFFFFFFu
+
+//Belady's MIN: the future of every access is precomputed, and each set keeps its ways
+//in a max-heap on the next use of the block they hold, so the victim is the root
+typedef struct opt_state {
+   unsigned *next_use; //per access: index of the next access to the same block, or OPT_NEVER
+   long long num_accesses;
+   long long position; //index of the access simulate_cache() sees next
+   unsigned *line_next; //per line: next use of the block it holds
+   int *heap; //per set, E slots: ways ordered as a max-heap on line_next
+   int *heap_pos; //per line: slot of that way in its set's heap
+   int *used; //per set: valid lines (sets fill way 0, 1, ... and never drain)
+} opt_state;
+
+//one backward pass over the records: the next use of each access's block
+opt_state *create_opt(char operations[], long memAddresses[], int numLines, int b, long long num_sets, int num_lines){
+   opt_state *opt = (opt_state *) calloc(1, sizeof(opt_state));
+   block_table last_seen;
+   long long count = 0;
+   int inserted;
+
+   for (int i = 0; i < numLines; i++){
+      if (operations[i] == 'L' || operations[i] == 'S') count += 1;
+      else if (operations[i] == 'M') count += 2;
+   }
+   if (count >= OPT_NEVER){
+      fprintf(stderr, "trace has too many accesses for --policy opt\n");
+      exit(1);
+   }
+   opt->next_use = (unsigned *) malloc(sizeof(unsigned) * (count + 1));
+   opt->num_accesses = count;
+   block_table_init(&last_seen, 1 << 16);
+   long long access = count;
+   for (int i = numLines - 1; i >= 0; i--){
+      int repeat = (operations[i] == 'M') ? 2 : (operations[i] == 'L' || operations[i] == 'S') ? 1 : 0;
+      mem_address_tag block = (mem_address_tag) memAddresses[i] >> b;
+      while (repeat-- > 0){
+         unsigned long long slot = block_table_insert(&last_seen, block, &inserted);
+         access--;
+         opt->next_use[access] = inserted ? OPT_NEVER : (unsigned) last_seen.values[slot];
+         last_seen.values[slot] = (int) access;
+      }
+   }
+   block_table_free(&last_seen);
+
+   opt->line_next = (unsigned *) calloc(num_sets * num_lines, sizeof(unsigned));
+   opt->heap = (int *) calloc(num_sets * num_lines, sizeof(int));
+   opt->heap_pos = (int *) calloc(num_sets * num_lines, sizeof(int));
+   opt->used = (int *) calloc(num_sets, sizeof(int));
+   return opt;
+}
+
+static inline void opt_heap_swap(opt_state *opt, long long base, int a, int b){
+   int way_a = opt->heap[base + a];
+   int way_b = opt->heap[base + b];
+   opt->heap[base + a] = way_b;
+   opt->heap[base + b] = way_a;
+   opt->heap_pos[base + way_b] = a;
+   opt->heap_pos[base + way_a] = b;
+}
+
+static inline void opt_sift_up(opt_state *opt, long long base, int slot){
+   while (slot > 0){
+      int parent = (slot - 1) / 2;
+      if (opt->line_next[base + opt->heap[base + parent]] >= opt->line_next[base + opt->heap[base + slot]]){
+         break;
+      }
+      opt_heap_swap(opt, base, slot, parent);
+      slot = parent;
+   }
+}
+
+static inline void opt_sift_down(opt_state *opt, long long base, int slot, int size){
+   for (;;){
+      int largest = slot;
+      int left = 2 * slot + 1;
+      int right = left + 1;
+      if (left < size && opt->line_next[base + opt->heap[base + left]] > opt->line_next[base + opt->heap[base + largest]]) largest = left;
+      if (right < size && opt->line_next[base + opt->heap[base + right]] > opt->line_next[base + opt->heap[base + largest]]) largest = right;
+      if (largest == slot){
+         return;
+      }
+      opt_heap_swap(opt, base, slot, largest);
+      slot = largest;
+   }
+}
+
+//OPT counterpart of simulate_cache; accesses must arrive in the order create_opt() saw them
+cache_attributes simulate_opt (cache my_cache, cache_attributes attributes, mem_address_tag address){
+   opt_state *opt = my_cache.opt;
+   unsigned next = opt->next_use[opt->position++];
+   int numLines = attributes.E;
+   unsigned long long set_index;
+   mem_address_tag input_tag;
+
+   locate_block(&my_cache, attributes.s, address >> attributes.b, &set_index, &input_tag);
+   cache_set this_set = cache_set_at(&my_cache, set_index);
+   long long base = (long long) set_index * numLines;
+   mem_address_tag match = (input_tag << my_cache.tag_shift) | LINE_VALID;
+   int used = opt->used[set_index];
+
+   for (int way = 0; way < used; way++){
+      if (this_set.lines[way].bits == match){//rank and flag bits stay 0 under OPT
+         attributes.hits++;
+         opt->line_next[base + way] = next; //later than before, so the way can only rise
+         opt_sift_up(opt, base, opt->heap_pos[base + way]);
+         return attributes;
+      }
+   }
+
+   attributes.misses++;
+   if (used < numLines){//fill the next empty way
+      opt->used[set_index] = used + 1;
+      this_set.lines[used].bits = match;
+      opt->line_next[base + used] = next;
+      opt->heap[base + used] = used;
+      opt->heap_pos[base + used] = used;
+      opt_sift_up(opt, base, used);
+   }
+   else {//evict the block used furthest in the future
+      int way = opt->heap[base];
+      attributes.evicts++;
+      this_set.lines[way].bits = match;
+      opt->line_next[base + way] = next;
+      opt_sift_down(opt, base, 0, numLines);
+   }
+   return attributes;
+}
+
+
+//lookup and fill for a cache with the hashed engine; same bookkeeping as the scan path below
+static cache_attributes simulate_fa (cache my_cache, cache_attributes attributes, mem_address_tag block, int miss_kind,
+                                     int is_write){
+   int evicted;
+   if (lru_table_access(my_cache.fa, block, &evicted)){
+        attributes.hits++;
+   }
+   else {
+        attributes.misses++;
+        if (my_cache.classifier != NULL){
+            if (miss_kind == MISS_COMPULSORY) attributes.compulsory++;
+            else if (miss_kind == MISS_CAPACITY) attributes.capacity++;
+            else attributes.conflict++;
+        }
+        int victim_slot = (my_cache.victim != NULL) ? victim_find(my_cache.victim, block) : -1;
+        if (victim_slot >= 0){
+            attributes.victim_hits++;
+        }
+        int from_buffer = 0;
+        if (my_cache.wbuf != NULL && !is_write && write_buffer_find(my_cache.wbuf, block) >= 0){
+            my_cache.wbuf->load_hits++;
+            from_buffer = 1;
+        }
+        if (my_cache.dram != NULL && victim_slot < 0 && !from_buffer){
+            dram_access(my_cache.dram, block, 0, 1 << attributes.b);
+        }
+        if (evicted){
+            attributes.evicts++;
+            if (my_cache.fa->last_evicted_dirty){
+                write_back_block(&my_cache, &attributes, my_cache.fa->last_evicted, 1, 1 << attributes.b);
+            }
+            if (my_cache.victim != NULL){
+                victim_insert(my_cache.victim, my_cache.fa->last_evicted, victim_slot);
+            }
+        }
+        else if (victim_slot >= 0){//the block moves back into the cache
+            my_cache.victim->blocks[victim_slot] = 0;
+            my_cache.victim->stamps[victim_slot] = 0;
+        }
+   }
+   if (my_cache.track_dirty && is_write){
+        my_cache.fa->dirty[my_cache.fa->head] = 1; //the accessed block is now the MRU node
+   }
+   if (my_cache.filter != NULL){
+        run_filter_record(my_cache.filter, block, 0);
+   }
+   return attributes;
+}
+
+//run the cache simulation for one access (functional model; simulate_cache() adds timing)
+static cache_attributes simulate_access (cache my_cache, cache_attributes attributes, mem_address_tag address, int is_write){
+   if (my_cache.opt != NULL){
+        return simulate_opt(my_cache, attributes, address);
+   }
+   int line_index;
+   int cache_filled = 1; //boolean for if cache is completely full
+   int numLines = attributes.E;
+   int hit_index = -1;
+
+   //masking instead of address << tag_size >> (tag_size + b): that shifts by 64 when s = 0
+   unsigned long long set_index = (address >> attributes.b) & ((1ULL << attributes.s) - 1);
+   mem_address_tag input_tag = address >> (attributes.s + attributes.b);
+   if (my_cache.full_tag){//hashed or non-power-of-two indexing
+        locate_block(&my_cache, attributes.s, address >> attributes.b, &set_index, &input_tag);
+   }
+   if (my_cache.fa == NULL && input_tag >> (64 - my_cache.tag_shift)){//the packed line has no room for this tag
+        fprintf(stderr, "address %llx is too wide for a packed line (s=%d b=%d E=%d)\n", address, attributes.s, attributes.b, numLines);
+        exit(1);
+   }
+
+   cache_set this_set = cache_set_at(&my_cache, set_index);
+
+   if (my_cache.tlb != NULL){
+        tlb_translate(my_cache.tlb, address);
+   }
+
+   int miss_kind = 0;
+   int prefetch_trigger = 0;
+   int victim_slot = -1;
+   if (my_cache.classifier != NULL){//classify before the lookup so hits still train the shadow cache
+        miss_kind = classify_access(my_cache.classifier, address >> attributes.b);
+   }
+   if (my_cache.prefetch != NULL){
+        my_cache.prefetch->now++;
+        if (my_cache.prefetch->num_pending > 0){
+            prefetch_drain(my_cache, &attributes);
+        }
+   }
+   if (my_cache.wbuf != NULL && my_cache.wbuf->policy == DRAIN_PERIODIC
+       && ++my_cache.wbuf->accesses % my_cache.wbuf->period == 0){
+        write_buffer_drain(my_cache.wbuf);
+   }
+   //(a store has to reach its line to set the dirty bit, so with write tracking only loads are filtered)
+   if (my_cache.filter != NULL && !(is_write && my_cache.track_dirty) && run_filter_hit(my_cache.filter, address >> attributes.b)){
+        attributes.hits++; //repeat of a set's MRU block: a hit with nothing to update
+        my_cache.filter->filtered++;
+        if (my_cache.prefetch != NULL){
+            prefetch_train(my_cache, &attributes, address >> attributes.b, 0);
+        }
+        return attributes;
+   }
+   if (my_cache.fa != NULL){
+        return simulate_fa(my_cache, attributes, address >> attributes.b, miss_kind, is_write);
+   }
+
+   mem_address_tag fill_bits = 0; //sector or dirty bits a fill or sector miss sets
+   if (my_cache.track_dirty && is_write){
+        fill_bits = LINE_DIRTY;
+   }
+   if (my_cache.sectors > 0){
+        int sector = (address >> (attributes.b - my_cache.sector_bits)) & (my_cache.sectors - 1);
+        fill_bits = 1ULL << (my_cache.sector_shift + sector);
+        if (is_write){
+            fill_bits |= fill_bits << my_cache.sectors;
+        }
+   }
+
+   //one compare per line: tag and valid bit together, ignoring rank and flags
+   mem_address_tag match = (input_tag << my_cache.tag_shift) | LINE_VALID;
+   mem_address_tag compare_mask = ~((1ULL << my_cache.tag_shift) - 1) | LINE_VALID;
+   for (line_index = 0; line_index < numLines; line_index++){
+        mem_address_tag bits = this_set.lines[line_index].bits;
+        if (((bits ^ match) & compare_mask) == 0){
+            hit_index = line_index;
+        }
+        cache_filled &= (int) (bits & LINE_VALID);
+   }
+
+   if (hit_index >= 0 && my_cache.sectors > 0){//tag match: a hit if the sector is valid too
+        set_line line = this_set.lines[hit_index];
+        if ((line.bits & fill_bits & ((1ULL << (my_cache.sector_shift + my_cache.sectors)) - 1)) == 0){
+            attributes.misses++; //sector miss: fetch the sector into the resident line
+            attributes.sector_misses++;
+            if (my_cache.dram != NULL){
+                dram_access(my_cache.dram, address >> attributes.b, 0, (1 << attributes.b) >> my_cache.sector_bits);
+            }
+        }
+        else {
+            attributes.hits++;
+        }
+        this_set.lines[hit_index].bits = line.bits | fill_bits;
+        promote_line(&my_cache, this_set, numLines, hit_index, line_rank(&my_cache, line));
+        return attributes;
+   }
+   if (hit_index >= 0){//it's a hit
+        attributes.hits++;
+        this_set.lines[hit_index].bits |= fill_bits;
+        if (this_set.lines[hit_index].bits & LINE_PREFETCHED){//first demand use of a prefetched line
+            attributes.pf_useful++;
+            this_set.lines[hit_index].bits &= ~LINE_PREFETCHED;
+            prefetch_trigger = 1;
+        }
+        promote_line(&my_cache, this_set, numLines, hit_index, line_rank(&my_cache, this_set.lines[hit_index]));
+        if (my_cache.filter != NULL){
+            run_filter_record(my_cache.filter, address >> attributes.b, set_index);
+        }
+        if (my_cache.prefetch != NULL){
+            prefetch_train(my_cache, &attributes, address >> attributes.b, prefetch_trigger);
+        }
+        return attributes; //there was already a hit and the data is already in the cache
+   }
+
+   //there was not a hit->so it must have been a miss.
+   attributes.misses++; //Increment the misses
+   if (my_cache.sectors > 0){
+        attributes.tag_misses++;
+   }
+   if (my_cache.classifier != NULL){
+        if (miss_kind == MISS_COMPULSORY) attributes.compulsory++;
+        else if (miss_kind == MISS_CAPACITY) attributes.capacity++;
+        else attributes.conflict++;
+   }
+   if (my_cache.prefetch != NULL){
+        prefetch_check_miss(my_cache.prefetch, &attributes, address >> attributes.b);
+   }
+   if (my_cache.victim != NULL){
+        victim_slot = victim_find(my_cache.victim, address >> attributes.b);
+        if (victim_slot >= 0){
+            attributes.victim_hits++;
+        }
+   }
+   int from_buffer = 0; //served by the victim cache or the write buffer instead of memory
+   if (my_cache.wbuf != NULL && !is_write && write_buffer_find(my_cache.wbuf, address >> attributes.b) >= 0){
+        my_cache.wbuf->load_hits++;
+        from_buffer = 1;
+   }
+   if (my_cache.dram != NULL && victim_slot < 0 && !from_buffer){
+        dram_access(my_cache.dram, address >> attributes.b, 0, (1 << attributes.b) >> my_cache.sector_bits);
+   }
+
+   int target = -1; //partitioned caches choose the way up front
+   if (my_cache.partition != NULL){
+        target = partition_target(&my_cache, this_set, numLines, &cache_filled);
+        partition_fill(my_cache.partition, set_index * numLines + target, cache_filled);
+   }
+
+   if (cache_filled){//if the cache is full, we'll need to overwrite the LRU line
+        int indexOf_least_used = (target >= 0) ? target : get_LRU(&my_cache, this_set, attributes);
+        set_line evicted = this_set.lines[indexOf_least_used];
+        attributes.evicts++;
+        write_back(&my_cache, &attributes, evicted, set_index);
+        if (my_cache.victim != NULL){//hand the evicted line to the victim cache (swap on a victim hit)
+            victim_insert(my_cache.victim, line_block(&my_cache, attributes.s, line_tag(&my_cache, evicted), set_index), victim_slot);
+        }
+        //write and replace LRU; update this
+        this_set.lines[indexOf_least_used].bits = (input_tag << my_cache.tag_shift) | (evicted.bits & my_cache.rank_mask) | fill_bits | LINE_VALID;
+        promote_line(&my_cache, this_set, numLines, indexOf_least_used, line_rank(&my_cache, evicted));
+   }
+   else { //there is at least one empty line that we can use: write to it.
+        if (victim_slot >= 0){//the block moves back into the cache
+            my_cache.victim->blocks[victim_slot] = 0;
+            my_cache.victim->stamps[victim_slot] = 0;
+        }
+        int indexOf_empty_line = (target >= 0) ? target : find_empty_line(this_set, attributes);
+        // update valid/ tag bits with the input cache's at the empty line 
+        this_set.lines[indexOf_empty_line].bits = (input_tag << my_cache.tag_shift) | fill_bits | LINE_VALID;
+        promote_line(&my_cache, this_set, numLines, indexOf_empty_line, numLines); //the new line is the most recently used
+   }
+   if (my_cache.filter != NULL){
+        run_filter_record(my_cache.filter, address >> attributes.b, set_index);
+   }
+   if (my_cache.prefetch != NULL){
+        prefetch_train(my_cache, &attributes, address >> attributes.b, 1);
+   }
+   return attributes;
+} //end of simulate_access
+
+
+//account one access in the timing model; before/after are the counters around it
+void timing_account(timing_model *timing, cache_attributes before, cache_attributes after, mem_address_tag block,
+                    int stlb_hit, int walk_refs){
+   unsigned long long now = timing->now;
+   unsigned long long latency;
+   int merged = -1;
+   int kept = 0;
+
+   //retire the misses that have completed by now
+   for (int i = 0; i < timing->outstanding; i++){
+        if (timing->mshr_ready[i] > now){
+            timing->mshr_block[kept] = timing->mshr_block[i];
+            timing->mshr_ready[kept] = timing->mshr_ready[i];
+            kept++;
+        }
+   }
+   timing->outstanding = kept;
+   for (int i = 0; i < timing->outstanding; i++){
+        if (timing->mshr_block[i] == block){
+            merged = i;
+        }
+   }
+
+   latency = timing->l1_latency;
+   if (stlb_hit) latency += timing->stlb_latency;
+   latency += (unsigned long long) walk_refs * timing->walk_latency;
+
+   if (merged >= 0){//the block is still on its way: wait for that fill (hit under miss, or a merged miss)
+        unsigned long long wait = timing->mshr_ready[merged] - now;
+        if (wait > latency) latency = wait;
+        timing->merged++;
+   }
+   else if (after.hits == before.hits && after.victim_hits == before.victim_hits){//a miss to memory needs an MSHR
+        if (timing->outstanding == timing->num_mshrs){//all busy: stall issue until the earliest one frees
+            int earliest = 0;
+            for (int i = 1; i < timing->outstanding; i++){
+                if (timing->mshr_ready[i] < timing->mshr_ready[earliest]) earliest = i;
+            }
+            timing->mshr_stalls += timing->mshr_ready[earliest] - now;
+            now = timing->mshr_ready[earliest];
+            timing->outstanding--;
+            timing->mshr_block[earliest] = timing->mshr_block[timing->outstanding];
+            timing->mshr_ready[earliest] = timing->mshr_ready[timing->outstanding];
+        }
+        latency += timing->memory_latency;
+        timing->mshr_block[timing->outstanding] = block;
+        timing->mshr_ready[timing->outstanding] = now + latency;
+        timing->outstanding++;
+        timing->mlp_sum += timing->outstanding;
+        timing->mlp_samples++;
+        if (timing->outstanding > timing->max_outstanding) timing->max_outstanding = timing->outstanding;
+   }
+   else if (after.victim_hits != before.victim_hits){
+        latency += timing->victim_latency;
+   }
+
+   int bucket = 0;
+   while (bucket < LATENCY_BUCKETS - 1 && (1ULL << (bucket + 1)) <= latency){
+        bucket++;
+   }
+   timing->histogram[bucket]++;
+   timing->total_latency += latency;
+   timing->accesses++;
+   if (now + latency > timing->finish) timing->finish = now + latency;
+   timing->now = now + 1; //one access issues per cycle
+}
+
+//run the cache simulation
+cache_attributes simulate_cache (cache my_cache, cache_attributes attributes, mem_address_tag address, int is_write){
+   if (my_cache.timing == NULL){
+        return simulate_access(my_cache, attributes, address, is_write);
+   }
+   int stlb_hits = 0;
+   int walk_refs = 0;
+   if (my_cache.tlb != NULL){
+        stlb_hits = my_cache.tlb->stlb_stats.hits;
+        walk_refs = my_cache.tlb->walk_refs;
+   }
+   cache_attributes after = simulate_access(my_cache, attributes, address, is_write);
+   if (my_cache.tlb != NULL){
+        stlb_hits = my_cache.tlb->stlb_stats.hits - stlb_hits;
+        walk_refs = my_cache.tlb->walk_refs - walk_refs;
+   }
+   timing_account(my_cache.timing, attributes, after, address >> attributes.b, stlb_hits, walk_refs);
+   return after;
+} //end of simulate_cache
+
+
+//count the records read_file() will store: data records, plus 'I' records when keep_instructions
+int count_lines(char *filename, int *numLines, int keep_instructions){
+
+   FILE *file = fopen(filename, "r");
+   if (file == NULL){
+      return -1;
+   }
+
+   char buff[25];
+   char *line = fgets(buff, 25, file);
+
+   int count = 0;
+   while (line){
+      if (keep_instructions || line[0] != 'I'){
+        count++;
+      }
+      line = fgets(buff, 25, file);
+   }
+   *numLines = count;
+   fclose(file);
+   return 0;
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+static inline unsigned long long fnv1a(unsigned long long hash, const char *bytes, size_t n){
+   for (size_t i = 0; i < n; i++){
+      hash = (hash ^ (unsigned char) bytes[i]) * FNV_PRIME;
+   }
+   return hash;
+}
+
+//method to read and parse the trace file
+//content_hash (optional) receives an FNV-1a hash of the raw file bytes, taken during the same pass
+//'I' records are dropped unless keep_instructions; they parse like any other record
+int read_file(char *filename, char operations[], long memAddresses[], int sizes[], unsigned long long *content_hash,
+              int keep_instructions){
+   FILE *file = fopen(filename, "r");
+   if (file == NULL){
+      return -1;
+   }
+   char buff[25];
+   char operation;
+   long mem_address;
+   int size;
+   unsigned long long hash = FNV_OFFSET;
+
+   char *line = fgets(buff, 25, file);
+
+int counter = 0;
+   while (line){
+      if (content_hash != NULL){
+        hash = fnv1a(hash, line, strlen(line));
+      }
+      if (keep_instructions || line[0] != 'I'){
+        sscanf(line, " %c %lx,%u", &operation, &mem_address, &size);
+        operations[counter] = operation;
+        memAddresses[counter] = mem_address;
+        sizes[counter] = size;
+        counter++;
+      }
+      line = fgets(buff, 25, file);
+   }
+   fclose(file);
+   if (content_hash != NULL){
+      *content_hash = hash;
+   }
+   return 0;
+}
+
+
+//on-disk result store: one small file per (trace content, configuration) pair, named by a hash
+//of the canonical key; the key is stored inside the file and compared on lookup, and entries
+//are written to a private temporary file and renamed into place, so concurrent writers
+//(batch workers or separate runs) never expose a partial entry
+static int result_tmp_counter;
+
+//canonical key: trace hash and record count, the geometry, then only the non-default options
+void result_key(char *key, size_t n, unsigned long long trace_hash, int numLines, cache_attributes attributes, char *options){
+   snprintf(key, n, "v1 trace=%016llx:%d s=%d E=%d b=%d%s", trace_hash, numLines, attributes.s, attributes.E,
+            attributes.b, options);
+}
+
+static void result_path(char *path, size_t n, char *dir, char *key){
+   snprintf(path, n, "%s/%016llx.res", dir, fnv1a(FNV_OFFSET, key, strlen(key)));
+}
+
+//returns 1 and fills in the counters when the store has this key
+int result_lookup(char *dir, char *key, cache_attributes *attributes){
+   char path[4096];
+   char stored[1024];
+   cache_attributes found = *attributes;
+   result_path(path, sizeof(path), dir, key);
+   FILE *file = fopen(path, "r");
+   if (file == NULL){
+      return 0;
+   }
+   int ok = fgets(stored, sizeof(stored), file) != NULL;
+   stored[strcspn(stored, "\n")] = '\0';
+   ok = ok && strcmp(stored, key) == 0
+        && fscanf(file, "%d %d %d %d %d %d %d %d %d %d %d", &found.hits, &found.misses, &found.evicts,
+                  &found.compulsory, &found.capacity, &found.conflict, &found.pf_issued, &found.pf_useful,
+                  &found.pf_late, &found.pf_polluting, &found.victim_hits) == 11;
+   fclose(file);
+   if (ok){
+      *attributes = found;
+   }
+   return ok;
+}
+
+void result_store(char *dir, char *key, cache_attributes attributes){
+   char path[4096];
+   char tmp[4096];
+   result_path(path, sizeof(path), dir, key);
+   snprintf(tmp, sizeof(tmp), "%s/.tmp.%d.%d", dir, (int) getpid(), __atomic_fetch_add(&result_tmp_counter, 1, __ATOMIC_RELAXED));
+   mkdir(dir, 0777); //first writer creates the store
+   FILE *file = fopen(tmp, "w");
+   if (file == NULL){
+      return; //the store is only an optimisation
+   }
+   fprintf(file, "%s\n%d %d %d %d %d %d %d %d %d %d %d\n", key, attributes.hits, attributes.misses, attributes.evicts,
+           attributes.compulsory, attributes.capacity, attributes.conflict, attributes.pf_issued, attributes.pf_useful,
+           attributes.pf_late, attributes.pf_polluting, attributes.victim_hits);
+   if (fclose(file) != 0 || rename(tmp, path) != 0){
+      unlink(tmp);
+   }
+}
+
+
+//block-address sidecar ("<trace>.b<b>.blk"): the trace as runs of consecutive accesses to
+//one block, pre-shifted by b, so runs with any s and E at this b skip the text parse;
+//the file is a header followed by an array of runs and is used through a read-only mapping
+#define BLOCK_STREAM_MAGIC "CSIMBLK2"
+
+//a run packed into one word: [ block | accesses - 1 (7 bits) | write ]; longer runs are split
+typedef unsigned long long block_run;
+#define BLOCK_RUN_WRITE 1ULL //the run contains a store or modify
+#define BLOCK_RUN_SHIFT 8
+#define BLOCK_RUN_MAX 128 //accesses per run
+
+typedef struct {
+   char magic[8];
+   int b;
+   int reserved;
+   long long trace_size; //stat() of the trace when the sidecar was written; a mismatch means stale
+   long long trace_mtime;
+   long long trace_mtime_nsec; //a rewrite within the same second keeps st_mtime
+   unsigned long long trace_hash; //read_file content hash, for the result store
+   long long trace_records; //non-'I' records in the trace
+   long long runs;
+} block_stream_header;
+
+typedef struct {
+   block_stream_header *header;
+   block_run *runs;
+   size_t map_size;
+} block_stream;
+
+static void block_stream_path(char *path, size_t n, char *trace_file, int b){
+   snprintf(path, n, "%s.b%d.blk", trace_file, b);
+}
+
+//map the sidecar for this trace and b; -1 when it is missing, malformed, or older than the trace
+int block_stream_open(block_stream *stream, char *trace_file, int b){
+   char path[4096];
+   struct stat trace_info;
+   struct stat info;
+   block_stream_path(path, sizeof(path), trace_file, b);
+   if (stat(trace_file, &trace_info) != 0){
+      return -1;
+   }
+   int fd = open(path, O_RDONLY);
+   if (fd < 0){
+      return -1;
+   }
+   if (fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(block_stream_header)){
+      close(fd);
+      return -1;
+   }
+   void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED){
+      return -1;
+   }
+   block_stream_header *header = (block_stream_header *) map;
+   if (memcmp(header->magic, BLOCK_STREAM_MAGIC, 8) != 0 || header->b != b
+       || header->trace_size != (long long) trace_info.st_size || header->trace_mtime != (long long) trace_info.st_mtime
+       || header->trace_mtime_nsec != (long long) trace_info.st_mtim.tv_nsec
+       || (size_t) info.st_size != sizeof(block_stream_header) + sizeof(block_run) * header->runs){
+      munmap(map, info.st_size);
+      return -1;
+   }
+   madvise(map, info.st_size, MADV_SEQUENTIAL);
+   stream->header = header;
+   stream->runs = (block_run *) (header + 1);
+   stream->map_size = info.st_size;
+   return 0;
+}
+
+void block_stream_close(block_stream *stream){
+   munmap(stream->header, stream->map_size);
+}
+
+//collapse the parsed records into runs and write the sidecar (temporary file + rename, so a
+//concurrent reader sees either no sidecar or a complete one); failures are silently ignored,
+//and a block too wide for the packed run (beyond 56 bits) leaves the trace without a sidecar
+void block_stream_write(char *trace_file, int b, char operations[], long memAddresses[], int numLines,
+                        unsigned long long trace_hash){
+   char path[4096];
+   char tmp[4096];
+   struct stat trace_info;
+   block_stream_header header;
+   block_run *runs = (block_run *) malloc(sizeof(block_run) * (numLines + 1));
+   long long count = 0;
+   mem_address_tag block = 0;
+   unsigned accesses = 0; //in the open run
+   block_run write = 0;
+
+   if (stat(trace_file, &trace_info) != 0){
+      free(runs);
+      return;
+   }
+   for (int i = 0; i <= numLines; i++){
+      if (i < numLines && operations[i] != 'L' && operations[i] != 'S' && operations[i] != 'M'){
+         continue;
+      }
+      mem_address_tag next = (i < numLines) ? (mem_address_tag) memAddresses[i] >> b : 0;
+      unsigned more = (i < numLines && operations[i] == 'M') ? 2 : 1;
+      if (i < numLines && accesses > 0 && next == block && accesses + more <= BLOCK_RUN_MAX){
+         accesses += more;
+         write |= (operations[i] == 'L') ? 0 : BLOCK_RUN_WRITE;
+         continue;
+      }
+      if (accesses > 0){//close the open run
+         runs[count++] = (block << BLOCK_RUN_SHIFT) | ((block_run) (accesses - 1) << 1) | write;
+      }
+      if (i < numLines){
+         if (next >> (64 - BLOCK_RUN_SHIFT)){
+            free(runs);
+            return;
+         }
+         block = next;
+         accesses = more;
+         write = (operations[i] == 'L') ? 0 : BLOCK_RUN_WRITE;
+      }
+   }
+
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, BLOCK_STREAM_MAGIC, 8);
+   header.b = b;
+   header.trace_size = trace_info.st_size;
+   header.trace_mtime = trace_info.st_mtime;
+   header.trace_mtime_nsec = trace_info.st_mtim.tv_nsec;
+   header.trace_hash = trace_hash;
+   header.trace_records = numLines;
+   header.runs = count;
+
+   block_stream_path(path, sizeof(path), trace_file, b);
+   snprintf(tmp, sizeof(tmp), "%.4000s.tmp.%d", path, (int) getpid());
+   FILE *file = fopen(tmp, "w");
+   if (file != NULL){
+      int ok = fwrite(&header, sizeof(header), 1, file) == 1
+               && fwrite(runs, sizeof(block_run), count, file) == (size_t) count;
+      if (fclose(file) != 0 || !ok || rename(tmp, path) != 0){
+         unlink(tmp);
+      }
+   }
+   free(runs);
+}
+
+//the first access of a run does the work; the rest are hits on the line it just made MRU
+cache_attributes replay_blocks(cache my_cache, cache_attributes attributes, block_stream *stream){
+   for (long long i = 0; i < stream->header->runs; i++){
+        block_run run = stream->runs[i];
+        attributes = simulate_cache(my_cache, attributes, (run >> BLOCK_RUN_SHIFT) << attributes.b, (int) (run & BLOCK_RUN_WRITE));
+        attributes.hits += (run >> 1) & (BLOCK_RUN_MAX - 1);
+   }
+   return attributes;
+}
+
+
+//large output buffer for -v; formatting is done by hand since printf per access dominates the run time
+typedef struct {
+   FILE *out;
+   char *buf;
+   size_t len;
+   size_t cap;
+} trace_writer;
+
+void writer_open(trace_writer *writer, FILE *out, size_t cap){
+   writer->out = out;
+   writer->buf = (char *) malloc(cap);
+   writer->len = 0;
+   writer->cap = cap;
+}
+
+void writer_flush(trace_writer *writer){
+   fwrite(writer->buf, 1, writer->len, writer->out);
+   writer->len = 0;
+}
+
+void writer_close(trace_writer *writer){
+   writer_flush(writer);
+   fflush(writer->out);
+   free(writer->buf);
+}
+
+static inline void writer_str(trace_writer *writer, const char *str, size_t n){
+   memcpy(writer->buf + writer->len, str, n);
+   writer->len += n;
+}
+
+//lowercase hex without leading zeros, as printf("%lx") would
+static inline void writer_hex(trace_writer *writer, unsigned long long value){
+   static const char digits[] = "0123456789abcdef";
+   char tmp[16];
+   int n = 0;
+   do {
+      tmp[n++] = digits[value & 0xf];
+      value >>= 4;
+   } while (value != 0);
+   while (n > 0){
+      writer->buf[writer->len++] = tmp[--n];
+   }
+}
+
+static inline void writer_dec(trace_writer *writer, unsigned value){
+   char tmp[10];
+   int n = 0;
+   do {
+      tmp[n++] = '0' + value % 10;
+      value /= 10;
+   } while (value != 0);
+   while (n > 0){
+      writer->buf[writer->len++] = tmp[--n];
+   }
+}
+
+//append " hit", " miss" or " miss eviction" by diffing the counters around one simulate_cache call
+static inline void writer_outcome(trace_writer *writer, cache_attributes before, cache_attributes after){
+   if (after.hits != before.hits){
+      writer_str(writer, " hit", 4);
+   }
+   else if (after.evicts != before.evicts){
+      writer_str(writer, " miss eviction", 14);
+   }
+   else {
+      writer_str(writer, " miss", 5);
+   }
+}
+
+//one "L 10,1 miss eviction" line; the longest possible line is well under 64 bytes
+static inline void writer_access(trace_writer *writer, char op, unsigned long long address, int size){
+   if (writer->len + 64 > writer->cap){
+      writer_flush(writer);
+   }
+   writer->buf[writer->len++] = op;
+   writer->buf[writer->len++] = ' ';
+   writer_hex(writer, address);
+   writer->buf[writer->len++] = ',';
+   writer_dec(writer, size);
+}
+
+
+//--outcomes: one 2-bit code per trace line, so a code's position is its record's line in the trace;
+//'I' lines are OUTCOME_NONE unless --icache/--unified simulates them, and an M record takes the worse
+//of its load and store halves (the store usually hits, but a late prefetch can evict the line)
+//file: header, then num_chunks + 1 file offsets (the last is the end of the file), then the
+//chunks; a chunk holds OUTCOME_CHUNK records (the last may be short) and starts with a kind
+//byte: OUTCOME_RAW packs four codes per byte, lowest bits first; OUTCOME_RLE is a run of
+//(code << 6 | run length - 1) bytes; with --outcomes-rle each chunk takes the smaller form
+#define OUTCOME_HIT 0
+#define OUTCOME_MISS 1
+#define OUTCOME_MISS_EVICTION 2
+#define OUTCOME_NONE 3 //record that did not access the cache
+#define OUTCOME_CHUNK 65536
+#define OUTCOME_RAW 0
+#define OUTCOME_RLE 1
+#define OUTCOME_MAGIC "CSIMOUT1"
+
+typedef struct {
+   char magic[8];
+   long long records;
+   int chunk_records;
+   int rle; //1 when chunks may be run-length encoded
+   long long num_chunks;
+} outcome_header;
+
+typedef struct {
+   FILE *out;
+   outcome_header header;
+   long long *offsets; //num_chunks + 1
+   long long chunk; //chunks written so far
+   int fill; //codes in the current chunk
+   unsigned char codes[OUTCOME_CHUNK]; //one code per byte until the chunk is encoded
+   unsigned char encoded[OUTCOME_CHUNK + 1];
+} outcome_writer;
+
+outcome_writer *outcome_open(char *filename, long long records, int rle){
+   FILE *out = fopen(filename, "wb");
+   if (out == NULL){
+      return NULL;
+   }
+   outcome_writer *writer = (outcome_writer *) calloc(1, sizeof(outcome_writer));
+   writer->out = out;
+   memcpy(writer->header.magic, OUTCOME_MAGIC, 8);
+   writer->header.records = records;
+   writer->header.chunk_records = OUTCOME_CHUNK;
+   writer->header.rle = rle;
+   writer->header.num_chunks = (records + OUTCOME_CHUNK - 1) / OUTCOME_CHUNK;
+   writer->offsets = (long long *) calloc(writer->header.num_chunks + 1, sizeof(long long));
+   fwrite(&writer->header, sizeof(outcome_header), 1, out);
+   fwrite(writer->offsets, sizeof(long long), writer->header.num_chunks + 1, out); //filled in on close
+   writer->offsets[0] = ftell(out);
+   return writer;
+}
+
+static void outcome_flush_chunk(outcome_writer *writer){
+   size_t raw = (writer->fill + 3) / 4;
+   size_t size = 0;
+   if (writer->header.rle){//run-length encode; give up once it is no smaller than the packed form
+      for (int i = 0; i < writer->fill && size < raw; ){
+         int run = 1;
+         while (run < 64 && i + run < writer->fill && writer->codes[i + run] == writer->codes[i]){
+            run++;
+         }
+         writer->encoded[1 + size++] = (unsigned char) (writer->codes[i] << 6 | (run - 1));
+         i += run;
+      }
+   }
+   if (writer->header.rle && size < raw){
+      writer->encoded[0] = OUTCOME_RLE;
+   }
+   else {
+      writer->encoded[0] = OUTCOME_RAW;
+      memset(writer->encoded + 1, 0, raw);
+      for (int i = 0; i < writer->fill; i++){
+         writer->encoded[1 + i / 4] |= writer->codes[i] << (2 * (i % 4));
+      }
+      size = raw;
+   }
+   fwrite(writer->encoded, 1, size + 1, writer->out);
+   writer->chunk++;
+   writer->offsets[writer->chunk] = writer->offsets[writer->chunk - 1] + size + 1;
+   writer->fill = 0;
+}
+
+//code for one access from the counters around it
+static inline unsigned char outcome_code(cache_attributes before, cache_attributes after){
+   if (after.hits != before.hits) return OUTCOME_HIT;
+   if (after.evicts != before.evicts) return OUTCOME_MISS_EVICTION;
+   if (after.misses != before.misses) return OUTCOME_MISS;
+   return OUTCOME_NONE;
+}
+
+static inline void outcome_record(outcome_writer *writer, unsigned char code){
+   writer->codes[writer->fill++] = code;
+   if (writer->fill == OUTCOME_CHUNK){
+      outcome_flush_chunk(writer);
+   }
+}
+
+int outcome_close(outcome_writer *writer){
+   if (writer->fill > 0){
+      outcome_flush_chunk(writer);
+   }
+   fseek(writer->out, sizeof(outcome_header), SEEK_SET);
+   fwrite(writer->offsets, sizeof(long long), writer->header.num_chunks + 1, writer->out);
+   int status = fclose(writer->out);
+   free(writer->offsets);
+   free(writer);
+   return status;
+}
+
+//--diff: a second (bare) geometry fed the same accesses in lockstep with the main cache; only
+//accesses whose hit/miss outcome differs are kept, counted per region of 2^region_bits bytes
+#define DIFF_TOP 10 //regions listed in the report
+
+typedef struct {
+   mem_address_tag region;
+   int hit_to_miss; //hit in the main cache, miss in the other
+   int miss_to_hit;
+} diff_region;
+
+typedef struct {
+   cache other;
+   cache_attributes attributes;
+   int region_bits;
+   long long hit_to_miss;
+   long long miss_to_hit;
+   block_table index; //region -> entry in regions
+   diff_region *regions;
+   int num_regions;
+   int capacity;
+} diff_run;
+
+diff_run *create_diff(int geometry[3], int filter_size, int region_bits){
+   diff_run *diff = (diff_run *) calloc(1, sizeof(diff_run));
+   diff->attributes.s = geometry[0];
+   diff->attributes.E = geometry[1];
+   diff->attributes.b = geometry[2];
+   diff->attributes.S = 1 << geometry[0];
+   diff->attributes.B = 1 << geometry[2];
+   diff->other = create_cache(1LL << geometry[0], geometry[1], 1LL << geometry[2]);
+   if (geometry[0] == 0 && geometry[1] >= FA_ENGINE_WAYS){
+      attach_fa_engine(&diff->other);
+   }
+   if (filter_size > 0){
+      diff->other.filter = create_run_filter(filter_size);
+   }
+   diff->region_bits = region_bits;
+   block_table_init(&diff->index, 1024);
+   diff->capacity = 1024;
+   diff->regions = (diff_region *) malloc(diff->capacity * sizeof(diff_region));
+   return diff;
+}
+
+//run the access on the other cache and count it if its outcome differs from the main cache's
+static inline void diff_access(diff_run *diff, mem_address_tag address, int is_write, int main_hit){
+   int hits = diff->attributes.hits;
+   diff->attributes = simulate_cache(diff->other, diff->attributes, address, is_write);
+   int other_hit = diff->attributes.hits != hits;
+   if (other_hit == main_hit){
+      return;
+   }
+   int inserted;
+   unsigned long long slot = block_table_insert(&diff->index, address >> diff->region_bits, &inserted);
+   if (inserted){
+      if (diff->num_regions == diff->capacity){
+         diff->capacity *= 2;
+         diff->regions = (diff_region *) realloc(diff->regions, diff->capacity * sizeof(diff_region));
+      }
+      diff->index.values[slot] = diff->num_regions;
+      diff->regions[diff->num_regions++] = (diff_region) {address >> diff->region_bits, 0, 0};
+   }
+   diff_region *region = &diff->regions[diff->index.values[slot]];
+   if (main_hit){
+      region->hit_to_miss++;
+      diff->hit_to_miss++;
+   }
+   else {
+      region->miss_to_hit++;
+      diff->miss_to_hit++;
+   }
+}
+
+//simulate_cache on the main cache, mirrored to the --diff cache when there is one
+static inline cache_attributes simulate_paired(cache my_cache, cache_attributes attributes, diff_run *diff,
+                                               mem_address_tag address, int is_write){
+   int hits = attributes.hits;
+   attributes = simulate_cache(my_cache, attributes, address, is_write);
+   if (diff != NULL){
+      diff_access(diff, address, is_write, attributes.hits != hits);
+   }
+   return attributes;
+}
+
+void print_diff(diff_run *diff){
+   cache_attributes other = diff->attributes;
+   printf("diff s=%d E=%d b=%d hits:%d misses:%d evictions:%d\n", other.s, other.E, other.b, other.hits, other.misses,
+          other.evicts);
+   printf("diff hit->miss:%lld miss->hit:%lld regions:%d\n", diff->hit_to_miss, diff->miss_to_hit, diff->num_regions);
+   //partial selection sort: the DIFF_TOP regions with the most flipped accesses, in either direction
+   int top = diff->num_regions < DIFF_TOP ? diff->num_regions : DIFF_TOP;
+   for (int i = 0; i < top; i++){
+      int best = i;
+      for (int j = i + 1; j < diff->num_regions; j++){
+         diff_region *a = &diff->regions[j];
+         diff_region *b = &diff->regions[best];
+         if (a->hit_to_miss + a->miss_to_hit > b->hit_to_miss + b->miss_to_hit){
+            best = j;
+         }
+      }
+      diff_region swap = diff->regions[i];
+      diff->regions[i] = diff->regions[best];
+      diff->regions[best] = swap;
+      printf("  region %llx hit->miss:%d miss->hit:%d\n", diff->regions[i].region << diff->region_bits,
+             diff->regions[i].hit_to_miss, diff->regions[i].miss_to_hit);
+   }
+}
+
+
+#define INTERVAL_CSV 0
+#define INTERVAL_JSON 1
+
+//periodic counter snapshots for --interval; rows go to a block-buffered stream
+typedef struct {
+   FILE *out;
+   char *buffer;
+   int format;
+   long long every; //accesses per interval
+   long long next; //access count at which the next row is due
+   cache_attributes last; //counters at the previous row
+} interval_log;
+
+int interval_open(interval_log *log, long long every, int format, char *filename){
+   log->out = (filename == NULL) ? stdout : fopen(filename, "w");
+   if (log->out == NULL){
+      return -1;
+   }
+   log->buffer = NULL;
+   if (log->out != stdout){//stdout is already in use, so it keeps its own buffering
+      log->buffer = (char *) malloc(1 << 20);
+      setvbuf(log->out, log->buffer, _IOFBF, 1 << 20);
+   }
+   log->format = format;
+   log->every = every;
+   log->next = every;
+   memset(&log->last, 0, sizeof(log->last));
+   if (format == INTERVAL_CSV){
+      fprintf(log->out, "accesses,hits,misses,evictions,miss_rate\n");
+   }
+   return 0;
+}
+
+//write one row with the hits/misses/evictions since the previous row
+void interval_emit(interval_log *log, cache_attributes attributes){
+   long long accesses = (long long) attributes.hits + attributes.misses;
+   int hits = attributes.hits - log->last.hits;
+   int misses = attributes.misses - log->last.misses;
+   int evicts = attributes.evicts - log->last.evicts;
+   double miss_rate = (hits + misses) ? (double) misses / (hits + misses) : 0.0;
+
+   if (log->format == INTERVAL_CSV){
+      fprintf(log->out, "%lld,%d,%d,%d,%.6f\n", accesses, hits, misses, evicts, miss_rate);
+   }
+   else {
+      fprintf(log->out, "{\"accesses\":%lld,\"hits\":%d,\"misses\":%d,\"evictions\":%d,\"miss_rate\":%.6f}\n",
+              accesses, hits, misses, evicts, miss_rate);
+   }
+   log->last = attributes;
+   log->next = accesses + log->every;
+}
+
+//flush the trailing partial interval and release the stream
+void interval_close(interval_log *log, cache_attributes attributes){
+   if (attributes.hits + attributes.misses > log->last.hits + log->last.misses){
+      interval_emit(log, attributes);
+   }
+   if (log->out != stdout){
+      fclose(log->out);
+      free(log->buffer);
+   }
+}
+
+
+//replay parsed records through a cache: loads and stores access once, modifies twice
+cache_attributes replay_trace(cache my_cache, cache_attributes attributes, char operations[], long memAddresses[], int numLines){
+   for (int i = 0; i < numLines; i++){
+        if (operations[i] == 'L' || operations[i] == 'S'){
+            attributes = simulate_cache(my_cache, attributes, memAddresses[i], operations[i] == 'S');
+        } else if (operations[i] == 'M'){
+            attributes = simulate_cache(my_cache, attributes, memAddresses[i], 0);
+            attributes = simulate_cache(my_cache, attributes, memAddresses[i], 1);
+        }
+   }
+   return attributes;
+}
+
+#define MAX_SET_BITS 30 //S = 2^s is an int in cache_attributes
+#define MAX_GEOMETRIES 256
+
+//one (trace, geometry) result of a batch run
+typedef struct {
+   int status; //0 ok, -1 trace could not be read, -2 no room for the cache
+   int hits;
+   int misses;
+   int evicts;
+} batch_result;
+
+//shared state of a batch run; jobs are numbered trace-major and handed out through next_job
+typedef struct {
+   char **traces;
+   int num_traces;
+   int geometries[MAX_GEOMETRIES][3]; //s, E, b
+   int num_geometries;
+   int filter_size;
+   char *result_dir; //NULL = no result store
+   batch_result *results;
+   long long next_job;
+} batch_run;
+
+//worker loop: memory is bounded by one parsed trace plus one cache arena per worker
+void *batch_worker(void *arg){
+   batch_run *run = (batch_run *) arg;
+   long long total = (long long) run->num_traces * run->num_geometries;
+   cache_arena arena = {NULL, 0};
+   int loaded = -1; //trace currently held in the record arrays
+   int numLines = 0;
+   char *operations = NULL;
+   long *memAddresses = NULL;
+   int *sizes = NULL;
+   unsigned long long trace_hash = 0;
+   char key[256];
+
+   for (;;){
+      long long job = __atomic_fetch_add(&run->next_job, 1, __ATOMIC_RELAXED);
+      if (job >= total){
+         break;
+      }
+      int trace = job / run->num_geometries;
+      int *geometry = run->geometries[job % run->num_geometries];
+      batch_result *result = &run->results[job];
+
+      if (trace != loaded){//consecutive jobs on the same trace skip the parse
+         free(operations);
+         free(memAddresses);
+         free(sizes);
+         operations = NULL;
+         memAddresses = NULL;
+         sizes = NULL;
+         loaded = -1;
+         if (count_lines(run->traces[trace], &numLines, 0) != 0){
+            result->status = -1;
+            continue;
+         }
+         operations = (char *) malloc(numLines + 1);
+         memAddresses = (long *) malloc(sizeof(long) * (numLines + 1));
+         sizes = (int *) malloc(sizeof(int) * (numLines + 1));
+         if (read_file(run->traces[trace], operations, memAddresses, sizes, run->result_dir ? &trace_hash : NULL, 0) != 0){
+            result->status = -1;
+            continue;
+         }
+         loaded = trace;
+      }
+
+      cache_attributes attributes;
+      run_filter filter;
+      memset(&attributes, 0, sizeof(attributes));
+      attributes.s = geometry[0];
+      attributes.E = geometry[1];
+      attributes.b = geometry[2];
+      attributes.S = 1 << attributes.s;
+      if (run->result_dir != NULL){
+         result_key(key, sizeof(key), trace_hash, numLines, attributes, "");
+         if (result_lookup(run->result_dir, key, &attributes)){
+            result->status = 0;
+            result->hits = attributes.hits;
+            result->misses = attributes.misses;
+            result->evicts = attributes.evicts;
+            continue;
+         }
+      }
+      if (cache_arena_reserve(&arena, (1LL << attributes.s) * attributes.E) != 0){//fail this job, not the batch
+         result->status = -2;
+         continue;
+      }
+      cache job_cache = create_cache_in(&arena, 1LL << attributes.s, attributes.E, 1LL << attributes.b);
+      if (attributes.s == 0 && attributes.E >= FA_ENGINE_WAYS){
+         attach_fa_engine(&job_cache);
+      }
+      if (run->filter_size > 0){
+         memset(&filter, 0, sizeof(filter));
+         filter.size = (run->filter_size > RUN_FILTER_MAX) ? RUN_FILTER_MAX : run->filter_size;
+         job_cache.filter = &filter;
+      }
+      attributes = replay_trace(job_cache, attributes, operations, memAddresses, numLines);
+      if (job_cache.fa != NULL){
+         detach_fa_engine(&job_cache);
+      }
+      if (run->result_dir != NULL){
+         result_store(run->result_dir, key, attributes);
+      }
+      result->status = 0;
+      result->hits = attributes.hits;
+      result->misses = attributes.misses;
+      result->evicts = attributes.evicts;
+   }
+   free(operations);
+   free(memAddresses);
+   free(sizes);
+   if (arena.lines != NULL){
+      munmap(arena.lines, sizeof(set_line) * arena.line_capacity);
+   }
+   return NULL;
+}
+
+//collect trace paths: every regular file in a directory, or one path per line of a manifest
+int batch_collect_traces(char *path, char ***traces){
+   struct stat info;
+   int count = 0;
+   int capacity = 64;
+   char **list = (char **) malloc(sizeof(char *) * capacity);
+
+   if (stat(path, &info) != 0){
+      return -1;
+   }
+   if (S_ISDIR(info.st_mode)){
+      struct dirent **entries;
+      int n = scandir(path, &entries, NULL, alphasort);
+      for (int i = 0; i < n; i++){
+         char *full = (char *) malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+         sprintf(full, "%s/%s", path, entries[i]->d_name);
+         if (stat(full, &info) == 0 && S_ISREG(info.st_mode)){
+            if (count == capacity){
+               capacity *= 2;
+               list = (char **) realloc(list, sizeof(char *) * capacity);
+            }
+            list[count++] = full;
+         }
+         else {
+            free(full);
+         }
+         free(entries[i]);
+      }
+      free(entries);
+   }
+   else {
+      FILE *manifest = fopen(path, "r");
+      char buff[4096];
+      if (manifest == NULL){
+         return -1;
+      }
+      while (fgets(buff, sizeof(buff), manifest)){
+         buff[strcspn(buff, "\r\n")] = '\0';
+         if (buff[0] == '\0' || buff[0] == '#'){
+            continue;
+         }
+         if (count == capacity){
+            capacity *= 2;
+            list = (char **) realloc(list, sizeof(char *) * capacity);
+         }
+         list[count++] = strdup(buff);
+      }
+      fclose(manifest);
+   }
+   *traces = list;
+   return count;
+}
+
+//parse "s,E,b;s,E,b;..." into run->geometries
+int batch_parse_geometries(batch_run *run, char *spec){
+   run->num_geometries = 0;
+   while (*spec != '\0' && run->num_geometries < MAX_GEOMETRIES){
+      int *geometry = run->geometries[run->num_geometries];
+      int used = 0;
+      if (sscanf(spec, " %d,%d,%d%n", &geometry[0], &geometry[1], &geometry[2], &used) != 3
+          || geometry[0] < 0 || geometry[0] > MAX_SET_BITS || geometry[1] < 1 || geometry[2] < 1
+          || geometry[0] + geometry[2] >= 64){
+         return -1;
+      }
+      run->num_geometries++;
+      spec += used;
+      while (*spec == ';' || *spec == ' '){
+         spec++;
+      }
+   }
+   return run->num_geometries;
+}
+
+//write s as a JSON string literal
+void json_string(FILE *out, const char *s){
+   fputc('"', out);
+   for (; *s != '\0'; s++){
+      unsigned char c = (unsigned char) *s;
+      if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+      else if (c < 0x20) fprintf(out, "\\u%04x", c);
+      else fputc(c, out);
+   }
+   fputc('"', out);
+}
+
+//run every (trace, geometry) pair over a thread pool and write one combined table
+int run_batch(char *trace_path, char *geometry_spec, int num_threads, int filter_size, int format, char *out_file,
+              char *result_dir){
+   batch_run run;
+   memset(&run, 0, sizeof(run));
+   run.filter_size = filter_size;
+   run.result_dir = result_dir;
+   run.num_traces = batch_collect_traces(trace_path, &run.traces);
+   if (run.num_traces < 0){
+      printf("cannot read traces from %s\n", trace_path);
+      return -1;
+   }
+   if (geometry_spec == NULL || batch_parse_geometries(&run, geometry_spec) <= 0){
+      printf("batch mode needs --geometries \"s,E,b;s,E,b;...\" with 0 <= s <= %d, E >= 1, b >= 1 and s + b < 64\n",
+             MAX_SET_BITS);
+      return -1;
+   }
+   long long total = (long long) run.num_traces * run.num_geometries;
+   run.results = (batch_result *) calloc(total > 0 ? total : 1, sizeof(batch_result));
+
+   if (num_threads < 1){
+      num_threads = 1;
+   }
+   pthread_t *workers = (pthread_t *) malloc(sizeof(pthread_t) * num_threads);
+   for (int i = 0; i < num_threads; i++){
+      pthread_create(&workers[i], NULL, batch_worker, &run);
+   }
+   for (int i = 0; i < num_threads; i++){
+      pthread_join(workers[i], NULL);
+   }
+   free(workers);
+
+   FILE *out = (out_file == NULL) ? stdout : fopen(out_file, "w");
+   if (out == NULL){
+      printf("cannot open %s\n", out_file);
+      return -1;
+   }
+   if (format == INTERVAL_CSV){
+      fprintf(out, "trace,s,E,b,hits,misses,evictions,miss_rate\n");
+   }
+   for (long long job = 0; job < total; job++){
+      char *trace = run.traces[job / run.num_geometries];
+      int *geometry = run.geometries[job % run.num_geometries];
+      batch_result *result = &run.results[job];
+      double miss_rate = (result->hits + result->misses) ? (double) result->misses / (result->hits + result->misses) : 0.0;
+      if (result->status == -2){
+         fprintf(stderr, "skipping %d,%d,%d on %s: cannot reserve the cache\n", geometry[0], geometry[1], geometry[2], trace);
+         continue;
+      }
+      if (result->status != 0){
+         fprintf(stderr, "skipping unreadable trace %s\n", trace);
+         continue;
+      }
+      if (format == INTERVAL_CSV){
+         fprintf(out, "%s,%d,%d,%d,%d,%d,%d,%.6f\n", trace, geometry[0], geometry[1], geometry[2],
+                 result->hits, result->misses, result->evicts, miss_rate);
+      }
+      else {
+         fprintf(out, "{\"trace\":");
+         json_string(out, trace);
+         fprintf(out, ",\"s\":%d,\"E\":%d,\"b\":%d,\"hits\":%d,\"misses\":%d,\"evictions\":%d,\"miss_rate\":%.6f}\n",
+                 geometry[0], geometry[1], geometry[2], result->hits, result->misses, result->evicts, miss_rate);
+      }
+   }
+   if (out != stdout){
+      fclose(out);
+   }
+   for (int i = 0; i < run.num_traces; i++){
+      free(run.traces[i]);
+   }
+   free(run.traces);
+   free(run.results);
+   return 0;
+}
+
+
+#define MRC_HASH_BITS 24 //sampling threshold resolution
+#define MRC_BUCKETS 64 //one bucket per power-of-two reuse distance
+
+//next data record of a trace being streamed: 1 for L/S, 2 for M, 0 for anything else, -1 at the end
+static int mrc_next_record(FILE *file, long *mem_address){
+   char buff[25];
+   char operation;
+   int size;
+   if (fgets(buff, 25, file) == NULL){
+      return -1;
+   }
+   if (buff[0] == 'I' || sscanf(buff, " %c %lx,%u", &operation, mem_address, &size) != 3){
+      return 0;
+   }
+   return (operation == 'M') ? 2 : (operation == 'L' || operation == 'S') ? 1 : 0;
+}
+
+//SHARDS-style miss-ratio curve: blocks are sampled by hash, so a sampled block keeps all of
+//its accesses; reuse distances among sampled blocks are scaled up by 1/rate
+//distances come from a Fenwick tree over sampled access times, with one marker per block at
+//its latest access, so state is proportional to the sample rather than the trace
+//the error column is the block-sampling error: the Horvitz-Thompson variance of the miss
+//estimate, (1 - rate) * sum over sampled blocks of (that block's misses)^2, over (rate * accesses)^2
+//streams the trace twice (count the sample, then measure it), so memory follows the sample, not the trace
+#define MRC_COLD 255 //bucket code of a first access: a miss at every size
+int run_mrc(char *trace_file, int b, double rate, char *out_file){
+   unsigned long long threshold = (unsigned long long) (rate * (1ULL << MRC_HASH_BITS));
+   unsigned long long mask = (1ULL << MRC_HASH_BITS) - 1;
+   long long total = 0; //all accesses
+   long long sampled = 0;
+   long long cold = 0;
+   double buckets[MRC_BUCKETS] = {0}; //bucket k: scaled distance d with 2^(k-1) <= d < 2^k (bucket 0: d < 1)
+   block_table last_access;
+   int inserted;
+   int repeat;
+   long mem_address;
+
+   FILE *file = fopen(trace_file, "r");
+   if (file == NULL){
+      printf("cannot open %s\n", trace_file);
+      return -1;
+   }
+   //first pass: how many accesses are sampled, to size the tree
+   while ((repeat = mrc_next_record(file, &mem_address)) >= 0){
+      total += repeat;
+      if (repeat && (hash_block((mem_address_tag) mem_address >> b) & mask) < threshold){
+         sampled += repeat;
+      }
+   }
+   if (sampled == 0){
+      fclose(file);
+      printf("no accesses sampled at rate %g\n", rate);
+      return -1;
+   }
+
+   int *tree = (int *) calloc(sampled + 1, sizeof(int)); //1-based Fenwick tree over sampled time
+   long long now = 0;
+   int num_blocks = 0; //distinct sampled blocks; last_access maps a block to its id
+   int block_capacity = 1024;
+   long long *last_time = (long long *) malloc(sizeof(long long) * block_capacity); //by id: latest sampled time
+   int *access_block = (int *) malloc(sizeof(int) * sampled); //by sampled time: block id and distance bucket
+   unsigned char *access_bucket = (unsigned char *) malloc(sampled);
+   block_table_init(&last_access, 1024);
+   rewind(file);
+   while ((repeat = mrc_next_record(file, &mem_address)) >= 0){
+      mem_address_tag block = (mem_address_tag) mem_address >> b;
+      if (repeat == 0 || (hash_block(block) & mask) >= threshold){
+         continue;
+      }
+      while (repeat-- > 0){
+         unsigned long long slot = block_table_insert(&last_access, block, &inserted);
+         now++;
+         if (inserted){
+            if (num_blocks == block_capacity){
+               block_capacity *= 2;
+               last_time = (long long *) realloc(last_time, sizeof(long long) * block_capacity);
+            }
+            last_access.values[slot] = num_blocks++;
+            cold++;
+            access_bucket[now - 1] = MRC_COLD;
+         }
+         else {
+            long long previous = last_time[last_access.values[slot]];
+            long long distinct = 0; //markers in (previous, now): distinct sampled blocks in between
+            for (long long k = now - 1; k > 0; k -= k & -k) distinct += tree[k];
+            for (long long k = previous; k > 0; k -= k & -k) distinct -= tree[k];
+            for (long long k = previous; k <= sampled; k += k & -k) tree[k]--;
+            double scaled = distinct / rate;
+            int bucket = 0;
+            while (bucket < MRC_BUCKETS - 1 && scaled >= (double) (1ULL << bucket)){
+               bucket++;
+            }
+            buckets[bucket]++;
+            access_bucket[now - 1] = (unsigned char) bucket;
+         }
+         for (long long k = now; k <= sampled; k += k & -k) tree[k]++;
+         access_block[now - 1] = last_access.values[slot];
+         last_time[last_access.values[slot]] = now;
+      }
+   }
+   fclose(file);
+
+   //SHARDS adjustment: credit the gap between expected and actual sample size to the shortest distances
+   double expected = total * rate;
+   buckets[0] += expected - sampled;
+
+   //per-size sum of squared block miss counts: group the sampled accesses by block (counting sort)
+   double square_sums[MRC_BUCKETS] = {0};
+   long long *first = (long long *) calloc(num_blocks + 1, sizeof(long long));
+   unsigned char *by_block = (unsigned char *) malloc(sampled);
+   for (long long t = 0; t < sampled; t++) first[access_block[t] + 1]++;
+   for (int id = 0; id < num_blocks; id++) first[id + 1] += first[id];
+   for (long long t = 0; t < sampled; t++) by_block[first[access_block[t]]++] = access_bucket[t];
+   for (long long t = 0, id = 0; id < num_blocks; id++){//first[id] now marks the end of block id's accesses
+      long long histogram[MRC_BUCKETS] = {0};
+      long long block_misses = 0; //cold plus distances above the size, for the size being summed
+      for (; t < first[id]; t++){
+         if (by_block[t] == MRC_COLD) block_misses++;
+         else histogram[by_block[t]]++;
+      }
+      for (int k = MRC_BUCKETS - 2; k >= 0; k--){
+         block_misses += histogram[k + 1];
+         square_sums[k] += (double) block_misses * block_misses;
+      }
+   }
+   free(first);
+   free(by_block);
+   free(access_block);
+   free(access_bucket);
+   free(last_time);
+
+   FILE *out = (out_file == NULL) ? stdout : fopen(out_file, "w");
+   if (out == NULL){
+      printf("cannot open %s\n", out_file);
+      return -1;
+   }
+   fprintf(out, "size_bytes,miss_ratio,std_error,clamped\n");
+   double misses;
+   int last_bucket = 0;
+   for (int k = 0; k < MRC_BUCKETS; k++){
+      if (buckets[k] > 0) last_bucket = k;
+   }
+   for (int k = 0; k <= last_bucket && k < MRC_BUCKETS - 1; k++){//cache of 2^k blocks misses on buckets above k
+      misses = cold;
+      for (int j = k + 1; j < MRC_BUCKETS; j++){
+         misses += buckets[j];
+      }
+      double ratio = misses / expected;
+      double std_error = sqrt((1.0 - rate) * square_sums[k]) / expected;
+      int clamped = ratio > 1.0 || ratio < 0.0; //the SHARDS adjustment pushed the estimate out of range
+      if (ratio > 1.0) ratio = 1.0;
+      if (ratio < 0.0) ratio = 0.0;
+      fprintf(out, "%llu,%.6f,%.6f,%d\n", (1ULL << k) << b, ratio, std_error, clamped);
+   }
+   fprintf(out, "# sampled %lld of %lld accesses (rate %g), %llu distinct sampled blocks\n",
+           sampled, total, rate, last_access.count);
+   if (out != stdout){
+      fclose(out);
+   }
+   free(tree);
+   block_table_free(&last_access);
+   return 0;
+}
+
+
+/* main takes in command line inputs and prints the cache hits, misses, and evictions */
+//one tenant of --tenants: its trace and its share of the shared cache's counters
+typedef struct {
+   char *path;
+   mem_address_tag mask;
+   int numLines;
+   char *operations;
+   long *memAddresses;
+   int *sizes;
+   int hits;
+   int misses;
+   int evicts;
+} tenant_trace;
+
+//parse "trace[:waymask],trace[:waymask],..." (hex masks; no mask = every way) and read the traces
+int load_tenants(char *spec, int num_lines, tenant_trace tenants[]){
+   int count = 0;
+   char *copy = strdup(spec);
+   mem_address_tag all_ways = (num_lines >= 64) ? ~0ULL : (1ULL << num_lines) - 1;
+
+   for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")){
+      tenant_trace *tenant = &tenants[count];
+      char *colon = strrchr(item, ':');
+      if (count == MAX_TENANTS){
+         return -1;
+      }
+      memset(tenant, 0, sizeof(*tenant));
+      tenant->mask = all_ways;
+      if (colon != NULL){
+         *colon = '\0';
+         tenant->mask = strtoull(colon + 1, NULL, 16) & all_ways;
+      }
+      tenant->path = strdup(item);
+      if (tenant->mask == 0 || count_lines(tenant->path, &tenant->numLines, 0) != 0){
+         return -1;
+      }
+      tenant->operations = (char *) malloc(tenant->numLines + 1);
+      tenant->memAddresses = (long *) malloc(sizeof(long) * (tenant->numLines + 1));
+      tenant->sizes = (int *) malloc(sizeof(int) * (tenant->numLines + 1));
+      read_file(tenant->path, tenant->operations, tenant->memAddresses, tenant->sizes, NULL, 0);
+      count++;
+   }
+   free(copy);
+   return count;
+}
+
+//interleave the tenants' records round-robin into the shared cache, one record per turn
+cache_attributes run_tenants(cache my_cache, cache_attributes attributes, tenant_trace tenants[], int num_tenants){
+   int active = num_tenants;
+   for (int i = 0; active > 0; i++){
+        active = 0;
+        for (int t = 0; t < num_tenants; t++){
+            tenant_trace *tenant = &tenants[t];
+            if (i >= tenant->numLines){
+                continue;
+            }
+            active++;
+            cache_attributes before = attributes;
+            my_cache.partition->tenant = t;
+            if (tenant->operations[i] == 'L' || tenant->operations[i] == 'S'){
+                attributes = simulate_cache(my_cache, attributes, tenant->memAddresses[i], tenant->operations[i] == 'S');
+            } else if (tenant->operations[i] == 'M'){
+                attributes = simulate_cache(my_cache, attributes, tenant->memAddresses[i], 0);
+                attributes = simulate_cache(my_cache, attributes, tenant->memAddresses[i], 1);
+            }
+            tenant->hits += attributes.hits - before.hits;
+            tenant->misses += attributes.misses - before.misses;
+            tenant->evicts += attributes.evicts - before.evicts;
+        }
+   }
+   return attributes;
+}
+
+void print_tenants(partition_state *partition, tenant_trace tenants[], int num_tenants){
+   for (int t = 0; t < num_tenants; t++){
+      printf("tenant %d %s ways:%llx hits:%d misses:%d evictions:%d cross-tenant evictions:%lld evicted by others:%lld\n",
+             t, tenants[t].path, tenants[t].mask, tenants[t].hits, tenants[t].misses, tenants[t].evicts,
+             partition->cross_evicts[t], partition->lost[t]);
+   }
+}
+
+#define PHASE_OPEN 0
+#define PHASE_PARSE 1
+#define PHASE_BUILD 2
+#define PHASE_SIMULATE 3
+#define PHASE_REPORT 4
+#define NUM_PHASES 5
+#define NUM_COUNTERS 4
+
+//--profile: wall time per phase of main, plus hardware counters around the simulate phase when
+//perf_event_open is permitted; every entry point returns at once when profiling is off, and
+//none of them sits inside the access loop
+typedef struct {
+   int enabled;
+   struct timespec last; //end of the previous phase
+   double seconds[NUM_PHASES];
+   int fds[NUM_COUNTERS]; //-1 when that counter could not be opened
+   long long counts[NUM_COUNTERS];
+} profiler;
+
+static const char *phase_names[NUM_PHASES] = {"open", "parse", "build", "simulate", "report"};
+static const char *counter_names[NUM_COUNTERS] = {"cycles", "instructions", "llc misses", "branch misses"};
+
+void profile_start(profiler *prof, int enabled){
+   memset(prof, 0, sizeof(*prof));
+   prof->enabled = enabled;
+   if (!enabled){
+      return;
+   }
+   static const unsigned long long configs[NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+   for (int i = 0; i < NUM_COUNTERS; i++){
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      prof->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+   }
+   clock_gettime(CLOCK_MONOTONIC, &prof->last);
+}
+
+//charge the time since the previous mark to phase
+static inline void profile_mark(profiler *prof, int phase){
+   struct timespec now;
+   if (!prof->enabled){
+      return;
+   }
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   prof->seconds[phase] += (now.tv_sec - prof->last.tv_sec) + (now.tv_nsec - prof->last.tv_nsec) * 1e-9;
+   prof->last = now;
+}
+
+static inline void profile_counters(profiler *prof, int on){
+   if (!prof->enabled){
+      return;
+   }
+   for (int i = 0; i < NUM_COUNTERS; i++){
+      if (prof->fds[i] >= 0){
+         ioctl(prof->fds[i], on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+      }
+   }
+}
+
+//filtered < 0 when there is no run filter
+void print_profile(profiler *prof, long long accesses, long long filtered){
+   if (!prof->enabled){
+      return;
+   }
+   printf("profile");
+   for (int k = 0; k < NUM_PHASES; k++){
+      printf(" %s:%.6fs", phase_names[k], prof->seconds[k]);
+   }
+   printf("\n");
+   if (prof->seconds[PHASE_SIMULATE] > 0){
+      printf("accesses/sec:%.0f\n", accesses / prof->seconds[PHASE_SIMULATE]);
+   }
+   int have_counters = 0;
+   for (int i = 0; i < NUM_COUNTERS; i++){
+      if (prof->fds[i] >= 0 && read(prof->fds[i], &prof->counts[i], sizeof(long long)) == sizeof(long long)){
+         printf("%s%s:%lld", have_counters ? " " : "simulate ", counter_names[i], prof->counts[i]);
+         have_counters = 1;
+      }
+      if (prof->fds[i] >= 0){
+         close(prof->fds[i]);
+      }
+   }
+   if (have_counters && prof->fds[0] >= 0 && prof->fds[1] >= 0 && prof->counts[0] > 0){
+      printf(" ipc:%.2f", (double) prof->counts[1] / prof->counts[0]);
+   }
+   printf(have_counters ? "\n" : "hardware counters unavailable\n");
+   if (filtered >= 0){
+      printf("run filter hits:%lld\n", filtered);
+   }
+}
+
+//summary line plus the optional statistics that live in cache_attributes
+void print_results(cache_attributes attributes, int classify, int prefetch_kind, int victim_entries){
+   printSummary(attributes.hits, attributes.misses, attributes.evicts);
+   if (classify){
+      printf("compulsory:%d capacity:%d conflict:%d\n", attributes.compulsory, attributes.capacity, attributes.conflict);
+   }
+   if (prefetch_kind >= 0){
+      printf("prefetch issued:%d useful:%d late:%d polluting:%d\n", attributes.pf_issued, attributes.pf_useful,
+             attributes.pf_late, attributes.pf_polluting);
+   }
+   if (victim_entries > 0){
+      printf("victim hits:%d\n", attributes.victim_hits);
+   }
+}
+
+int main(int argc, char **argv)
+{
+    cache this_cache; //initialize a cache
+    cache_attributes attributes; //initialize cache_attributes
+    memset(&attributes, 0, sizeof(attributes));
+    int have_s = 0; //s = 0 (fully associative) is a valid choice, so track whether -s was given
+    int classify = 0;
+    long long interval = 0; //0 = no time series
+    int interval_format = INTERVAL_CSV;
+    char *interval_file = NULL;
+    interval_log intervals;
+    int verbosity = 0;
+    int prefetch_kind = -1; //-1 = no prefetcher
+    int prefetch_degree = 1;
+    int prefetch_distance = 1;
+    int prefetch_latency = 0;
+    int victim_entries = 0;
+    int page_bits = 0; //0 = no TLB model
+    int dtlb_s = 4, dtlb_E = 4; //64-entry 4-way L1 DTLB
+    int stlb_s = 7, stlb_E = 12; //1536-entry 12-way STLB
+    int pwc_s = 1, pwc_E = 0; //page-walk cache off by default
+    int filter_size = 4; //same-block run filter entries, 0 = off
+    char *timing_spec = NULL; //--timing "l1=4,mem=100,..." turns the timing model on
+    int num_mshrs = 10;
+    char *result_dir = NULL; //--result-cache DIR: reuse results of identical earlier runs
+    unsigned long long trace_hash = 0;
+    char result_options[512] = "";
+    char key[1024];
+    int use_store = 0;
+    int use_blocks = 0; //--blocks: read or write the block-address sidecar
+    block_stream stream;
+    int have_stream = 0;
+    int profile = 0; //--profile
+    char *tenant_spec = NULL; //--tenants: several traces sharing one way-partitioned cache
+    tenant_trace tenants[MAX_TENANTS];
+    int num_tenants = 0;
+    int sectors = 0; //--sectors: 0 = unsectored lines
+    int wbuf_entries = 0; //--write-buffer: 0 = dirty evictions go straight to memory
+    int wbuf_policy = DRAIN_FULL;
+    int wbuf_period = 0;
+    char *dram_spec = NULL; //--dram: model memory behind the cache
+    int instructions = 0; //simulate 'I' records: --icache (split L1I) or --unified
+    int icache_geometry[3] = {0, 0, 0}; //s, E, b of the L1I
+    cache icache;
+    cache_attributes icache_attributes;
+    cache_attributes fetches; //instruction-fetch share of the counters
+    char *outcome_file = NULL; //--outcomes: per-record hit/miss codes
+    int outcome_rle = 0;
+    outcome_writer *outcomes = NULL;
+    int diff_geometry[3] = {-1, 0, 0}; //--diff: s, E, b of the configuration compared against
+    int diff_region_bits = 12;
+    diff_run *diff = NULL;
+    memset(&icache_attributes, 0, sizeof(icache_attributes));
+    memset(&fetches, 0, sizeof(fetches));
+    profiler prof;
+    double mrc_rate = 0; //0 = no miss-ratio curve
+    char *mrc_file = NULL;
+    int policy_opt = 0; //--policy opt: Belady replacement instead of LRU
+    char *batch_path = NULL; //directory or manifest of traces for batch mode
+    char *batch_geometries = NULL;
+    char *batch_out = NULL;
+    int batch_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int index_mode = INDEX_BITS;
+    long long set_count = 0; //0 = 2^s sets
+    mem_address_tag matrix[MAX_MATRIX_ROWS];
+    int matrix_rows = 0;
+    trace_writer verbose;
+    cache_attributes before = {0}; //counters before the current record (-v, --outcomes)
+
+    long long num_sets;
+    long long block_size;
+
+    FILE *read_trace;
+
+    char *trace_file = NULL;
+    int c;
+    /*long options for the optional analyses; the short ones match the lab driver*/
+    static struct option long_options[] = {
+        {"classify", no_argument, 0, 'C'},
+        {"interval", required_argument, 0, 'N'},
+        {"interval-format", required_argument, 0, 'F'},
+        {"interval-out", required_argument, 0, 'O'},
+        {"prefetch", required_argument, 0, 'P'},
+        {"prefetch-degree", required_argument, 0, 'D'},
+        {"prefetch-distance", required_argument, 0, 'R'},
+        {"prefetch-latency", required_argument, 0, 'L'},
+        {"victim", required_argument, 0, 'V'},
+        {"tlb", required_argument, 0, 'T'},
+        {"dtlb", required_argument, 0, 'X'},
+        {"stlb", required_argument, 0, 'Y'},
+        {"pwc", required_argument, 0, 'W'},
+        {"index", required_argument, 0, 'I'},
+        {"sets", required_argument, 0, 'S'},
+        {"run-filter", required_argument, 0, 'U'},
+        {"policy", required_argument, 0, 'p'},
+        {"mrc", required_argument, 0, 'm'},
+        {"timing", required_argument, 0, 'a'},
+        {"mshrs", required_argument, 0, 'H'},
+        {"result-cache", required_argument, 0, 'K'},
+        {"blocks", no_argument, 0, 'k'},
+        {"profile", no_argument, 0, 'A'},
+        {"tenants", required_argument, 0, 'M'},
+        {"sectors", required_argument, 0, 'c'},
+        {"write-buffer", required_argument, 0, 'w'},
+        {"wb-drain", required_argument, 0, 'd'},
+        {"dram", required_argument, 0, 'r'},
+        {"icache", required_argument, 0, 'i'},
+        {"unified", no_argument, 0, 'u'},
+        {"outcomes", required_argument, 0, 'e'},
+        {"outcomes-rle", no_argument, 0, 'z'},
+        {"diff", required_argument, 0, 'n'},
+        {"diff-region", required_argument, 0, 'g'},
+        {"mrc-out", required_argument, 0, 'o'},
+        {"batch", required_argument, 0, 'B'},
+        {"geometries", required_argument, 0, 'G'},
+        {"jobs", required_argument, 0, 'J'},
+        {"batch-out", required_argument, 0, 'Q'},
+        {0, 0, 0, 0}
+    };
+    /*parse the command line args*/
+    while( (c=getopt_long(argc,argv,"s:E:b:t:vh",long_options,NULL)) != -1){
+        switch(c){
+        case 'C'://split misses into compulsory/capacity/conflict
+            classify = 1;
+            break;
+        case 'N'://emit hits/misses/evictions every N accesses
+            interval = atoll(optarg);
+            break;
+        case 'F'://csv or json (one object per line)
+            if (strcmp(optarg, "json") == 0) interval_format = INTERVAL_JSON;
+            else if (strcmp(optarg, "csv") == 0) interval_format = INTERVAL_CSV;
+            else {
+                printf("%s: unknown interval format %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'O':
+            interval_file = optarg;
+            break;
+        case 'P'://next-line, stride or stream
+            if (strcmp(optarg, "next-line") == 0) prefetch_kind = PREFETCH_NEXT_LINE;
+            else if (strcmp(optarg, "stride") == 0) prefetch_kind = PREFETCH_STRIDE;
+            else if (strcmp(optarg, "stream") == 0) prefetch_kind = PREFETCH_STREAM;
+            else {
+                printf("%s: unknown prefetcher %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'D':
+            prefetch_degree = atoi(optarg);
+            break;
+        case 'R':
+            prefetch_distance = atoi(optarg);
+            break;
+        case 'L':
+            prefetch_latency = atoi(optarg);
+            break;
+        case 'V'://entries in the victim cache
+            victim_entries = atoi(optarg);
+            break;
+        case 'T'://page size: 4k, 2m or 1g
+            if (strcasecmp(optarg, "4k") == 0) page_bits = 12;
+            else if (strcasecmp(optarg, "2m") == 0) page_bits = 21;
+            else if (strcasecmp(optarg, "1g") == 0) page_bits = 30;
+            else {
+                printf("%s: unknown page size %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'X'://"s,E" of the L1 DTLB
+            if (sscanf(optarg, "%d,%d", &dtlb_s, &dtlb_E) != 2 || dtlb_s < 0 || dtlb_s > MAX_SET_BITS || dtlb_E < 1){
+                printf("%s: --dtlb wants s,E with 0 <= s <= %d and E >= 1\n", argv[0], MAX_SET_BITS);
+                exit(1);
+            }
+            break;
+        case 'Y'://"s,E" of the STLB, E = 0 leaves it out
+            if (sscanf(optarg, "%d,%d", &stlb_s, &stlb_E) != 2 || stlb_s < 0 || stlb_s > MAX_SET_BITS || stlb_E < 0){
+                printf("%s: --stlb wants s,E with 0 <= s <= %d and E >= 0\n", argv[0], MAX_SET_BITS);
+                exit(1);
+            }
+            break;
+        case 'W'://"s,E" of each page-walk cache level
+            if (sscanf(optarg, "%d,%d", &pwc_s, &pwc_E) != 2 || pwc_s < 0 || pwc_s > MAX_SET_BITS || pwc_E < 0){
+                printf("%s: --pwc wants s,E with 0 <= s <= %d and E >= 0\n", argv[0], MAX_SET_BITS);
+                exit(1);
+            }
+            break;
+        case 'I'://bits, xor, or matrix:ROW,ROW,... (hex row masks, one per index bit)
+            if (strcmp(optarg, "bits") == 0) index_mode = INDEX_BITS;
+            else if (strcmp(optarg, "xor") == 0) index_mode = INDEX_XOR;
+            else if (strncmp(optarg, "matrix:", 7) == 0){
+                char *row = optarg + 7;
+                index_mode = INDEX_MATRIX;
+                while (*row != '\0' && matrix_rows < MAX_MATRIX_ROWS){
+                    matrix[matrix_rows++] = strtoull(row, &row, 16);
+                    if (*row == ',') row++;
+                }
+            }
+            else {
+                printf("%s: unknown index function %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'S'://any set count, e.g. 12 or 20 LLC slices' worth
+            set_count = atoll(optarg);
+            break;
+        case 'U'://entries in the same-block run filter, 0 turns it off
+            filter_size = atoi(optarg);
+            break;
+        case 'p'://lru (default) or opt
+            if (strcmp(optarg, "opt") == 0) policy_opt = 1;
+            else if (strcmp(optarg, "lru") == 0) policy_opt = 0;
+            else {
+                printf("%s: unknown replacement policy %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'a'://latencies as level=cycles pairs (l1, victim, mem, stlb, walk); "" keeps the defaults
+            timing_spec = optarg;
+            break;
+        case 'H':
+            num_mshrs = atoi(optarg);
+            break;
+        case 'K':
+            result_dir = optarg;
+            break;
+        case 'k':
+            use_blocks = 1;
+            break;
+        case 'A':
+            profile = 1;
+            break;
+        case 'M'://"trace:f0,trace:0f": traces interleaved into one cache, each filling only its ways
+            tenant_spec = optarg;
+            break;
+        case 'w':
+            wbuf_entries = atoi(optarg);
+            break;
+        case 'd'://full, watermark, or every:N
+            if (strcmp(optarg, "full") == 0) wbuf_policy = DRAIN_FULL;
+            else if (strcmp(optarg, "watermark") == 0) wbuf_policy = DRAIN_WATERMARK;
+            else if (sscanf(optarg, "every:%d", &wbuf_period) == 1 && wbuf_period > 0) wbuf_policy = DRAIN_PERIODIC;
+            else {
+                printf("%s: unknown write buffer drain policy %s\n", argv[0], optarg);
+                exit(1);
+            }
+            break;
+        case 'r'://"channels=2,ranks=1,banks=8,row=8192,policy=open|closed,queue=16"; "" keeps the defaults
+            dram_spec = optarg;
+            break;
+        case 'i'://"s,E,b": 'I' records go to a separate L1I with this geometry
+            if (sscanf(optarg, "%d,%d,%d", &icache_geometry[0], &icache_geometry[1], &icache_geometry[2]) != 3
+                || icache_geometry[0] < 0 || icache_geometry[0] > MAX_SET_BITS || icache_geometry[1] < 1 || icache_geometry[2] < 1
+                || icache_geometry[0] + icache_geometry[2] >= 64){
+                printf("%s: --icache wants s,E,b with 0 <= s <= %d, E >= 1, b >= 1 and s + b < 64\n", argv[0], MAX_SET_BITS);
+                exit(1);
+            }
+            instructions = 1;
+            break;
+        case 'u'://'I' records share the data cache
+            instructions = 2;
+            break;
+        case 'e':
+            outcome_file = optarg;
+            break;
+        case 'z'://run-length encode outcome chunks where that is smaller
+            outcome_rle = 1;
+            break;
+        case 'n'://"s,E,b": run a second geometry in lockstep and report where the outcomes differ
+            if (sscanf(optarg, "%d,%d,%d", &diff_geometry[0], &diff_geometry[1], &diff_geometry[2]) != 3
+                || diff_geometry[0] < 0 || diff_geometry[0] > MAX_SET_BITS || diff_geometry[1] < 1 || diff_geometry[2] < 1
+                || diff_geometry[0] + diff_geometry[2] >= 64){
+                printf("%s: --diff wants s,E,b with 0 <= s <= %d, E >= 1, b >= 1 and s + b < 64\n", argv[0], MAX_SET_BITS);
+                exit(1);
+            }
+            break;
+        case 'g'://log2 of the bytes grouped into one --diff region (default 12, a 4 KiB page)
+            diff_region_bits = atoi(optarg);
+            if (diff_region_bits < 0 || diff_region_bits > 63){
+                printf("%s: --diff-region wants 0..63\n", argv[0]);
+                exit(1);
+            }
+            break;
+        case 'c'://sectors per line (2, 4 or 8), each with its own valid and dirty bit
+            sectors = atoi(optarg);
+            break;
+        case 'm'://sample blocks at this rate and print an approximate miss-ratio curve
+            mrc_rate = atof(optarg);
+            if (!(mrc_rate > 0 && mrc_rate <= 1)){
+                printf("%s: --mrc wants a sampling rate in (0, 1]\n", argv[0]);
+                exit(1);
+            }
+            break;
+        case 'o':
+            mrc_file = optarg;
+            break;
+        case 'B'://run every trace in a directory or manifest against --geometries
+            batch_path = optarg;
+            break;
+        case 'G':
+            batch_geometries = optarg;
+            break;
+        case 'J'://worker threads for batch mode
+            batch_threads = atoi(optarg);
+            break;
+        case 'Q':
+            batch_out = optarg;
+            break;
+        case 's':
+            attributes.s = atoi(optarg);
+            have_s = 1;
+            break;
+        case 'E':
+            attributes.E = atoi(optarg);
+            break;
+        case 'b':
+            attributes.b = atoi(optarg);
             break;
         case 't':
             trace_file = optarg;
             break;
-        case 'v'://don't need to use
+        case 'v'://print the outcome of every access
+            verbosity = 1;
             break;
         default:
             exit(1);
         }
     }
+    if (batch_path != NULL && (policy_opt || classify || prefetch_kind >= 0 || victim_entries > 0 || set_count > 0
+                               || index_mode != INDEX_BITS || page_bits > 0 || sectors > 0 || wbuf_entries > 0
+                               || dram_spec != NULL || timing_spec != NULL || instructions || outcome_file != NULL
+                               || diff_geometry[0] >= 0 || verbosity || interval > 0 || tenant_spec != NULL || mrc_rate > 0)){
+        //batch jobs run the bare LRU cache and print only its counters
+        printf("%s: --batch runs plain LRU geometries; drop --policy/--classify/--prefetch/--victim/--sets/--index/--tlb,\n"
+               "--sectors/--write-buffer/--dram/--timing/--icache/--unified/--outcomes/--diff/-v/--interval/--tenants/--mrc\n",
+               argv[0]);
+        exit(1);
+    }
+    if (batch_path != NULL){//batch mode writes its own table; --interval-format picks csv or json
+        return run_batch(batch_path, batch_geometries, batch_threads, filter_size, interval_format, batch_out,
+                         result_dir) == 0 ? 0 : 1;
+    }
     /*make sure all of the required inputs have been supplied*/
-    if (attributes.s == 0 || attributes.E == 0 || attributes.b == 0 || trace_file == NULL) {
+    /*(a miss-ratio curve covers every cache size, so it only needs b)*/
+    if ((mrc_rate <= 0 && (!have_s || attributes.E == 0)) || attributes.b == 0 || (trace_file == NULL && tenant_spec == NULL)) {
         printf("%s: Missing required command line argument\n", argv[0]);
         exit(1);
     }
 
+    if (tenant_spec != NULL && (attributes.E > 64 || prefetch_kind >= 0 || policy_opt || verbosity || interval > 0 || mrc_rate > 0)){
+        printf("%s: --tenants needs E <= 64 and no --prefetch, --policy opt, -v, --interval or --mrc\n", argv[0]);
+        exit(1);
+    }
+    if (sectors != 0 && (sectors < 2 || sectors > 8 || (sectors & (sectors - 1)) != 0 || sectors > (1 << attributes.b))){
+        printf("%s: --sectors must be 2, 4 or 8 and no more than the block size\n", argv[0]);
+        exit(1);
+    }
+    if (sectors > 0 && (classify || prefetch_kind >= 0 || victim_entries > 0 || policy_opt)){
+        printf("%s: --sectors works on the bare cache; drop --classify/--prefetch/--victim/--policy opt\n", argv[0]);
+        exit(1);
+    }
+    if (sectors > 0){//the run filter and the sidecar assume a repeat of a block is a hit
+        filter_size = 0;
+        use_blocks = 0;
+    }
+    if (wbuf_entries > 0 || dram_spec != NULL || instructions || outcome_file != NULL || diff_geometry[0] >= 0){
+        use_blocks = 0; //the sidecar drops the per-access stores, 'I' records and record boundaries
+    }
+    if (diff_geometry[0] >= 0 && (tenant_spec != NULL || policy_opt || mrc_rate > 0)){
+        printf("%s: --diff does not combine with --tenants, --policy opt or --mrc\n", argv[0]);
+        exit(1);
+    }
+    if (outcome_file != NULL && tenant_spec != NULL){
+        printf("%s: --outcomes follows the records of one trace; it does not combine with --tenants\n", argv[0]);
+        exit(1);
+    }
+    if (instructions && (tenant_spec != NULL || policy_opt || mrc_rate > 0)){
+        printf("%s: --icache/--unified do not combine with --tenants, --policy opt or --mrc\n", argv[0]);
+        exit(1);
+    }
+    if (instructions == 1 && icache_geometry[2] != attributes.b && (dram_spec != NULL || wbuf_entries > 0 || timing_spec != NULL)){
+        //the memory-side models count in data-cache blocks
+        printf("%s: --icache needs the data cache's b with --dram, --write-buffer or --timing\n", argv[0]);
+        exit(1);
+    }
+    /*the sidecar only holds block runs, so anything that needs single accesses or the ops parses the trace*/
+    use_blocks = use_blocks && tenant_spec == NULL && !verbosity && interval == 0 && prefetch_kind < 0 && timing_spec == NULL
+                 && page_bits == 0 && !policy_opt && mrc_rate <= 0;
+    if (mrc_rate > 0){//streams the trace itself
+        return run_mrc(trace_file, attributes.b, mrc_rate, mrc_file) == 0 ? 0 : 1;
+    }
+    int numLines = 0;
+    char *operations = NULL;
+    long *memAddresses = NULL;
+    int *sizes = NULL;
+    profile_start(&prof, profile);
+    if (tenant_spec != NULL){
+        num_tenants = load_tenants(tenant_spec, attributes.E, tenants);
+        if (num_tenants <= 0){
+            printf("%s: bad --tenants %s (unreadable trace, empty way mask, or over %d tenants)\n", argv[0], tenant_spec, MAX_TENANTS);
+            exit(1);
+        }
+        profile_mark(&prof, PHASE_PARSE);
+    }
+    else if (use_blocks && block_stream_open(&stream, trace_file, attributes.b) == 0){
+        have_stream = 1;
+        numLines = stream.header->trace_records;
+        trace_hash = stream.header->trace_hash;
+        profile_mark(&prof, PHASE_OPEN);
+    }
+    else {
+        /*count the number of non-'I' operation lines in the input file;*/
+        if (count_lines(trace_file, &numLines, instructions || outcome_file != NULL) != 0){
+            printf("%s: cannot open %s\n", argv[0], trace_file);
+            exit(1);
+        }
+        profile_mark(&prof, PHASE_OPEN);
+
+        /*arrays to store the operation, memory address and size of each entry*/
+        /*(on the heap: large traces overflow the stack)*/
+        operations = (char *) malloc(numLines + 1);
+        memAddresses = (long *) malloc(sizeof(long) * (numLines + 1));
+        sizes = (int *) malloc(sizeof(int) * (numLines + 1));
+
+        /*read in file and store info to arrays*/
+        read_file(trace_file, operations, memAddresses, sizes, &trace_hash, instructions || outcome_file != NULL);
+        if (use_blocks){
+            block_stream_write(trace_file, attributes.b, operations, memAddresses, numLines, trace_hash);
+        }
+        profile_mark(&prof, PHASE_PARSE);
+    }
+
     /* compute S and B based on information passed in; S = 2^s and B = 2^b */
     num_sets = pow(2.0, attributes.s);
+    if (set_count > 0){
+        num_sets = set_count;
+        if ((num_sets & (num_sets - 1)) == 0){
+            attributes.s = __builtin_ctzll(num_sets); //keep s consistent with a power-of-two count
+        }
+    }
+    attributes.S = num_sets;
+    if (index_mode == INDEX_MATRIX && (1LL << matrix_rows) < num_sets){
+        printf("%s: a %d-row hash matrix cannot index %lld sets\n", argv[0], matrix_rows, num_sets);
+        exit(1);
+    }
     block_size = pow(2.0, attributes.b); 
     attributes.hits = 0;
     attributes.misses = 0;
     attributes.evicts = 0;
 
+    //only runs whose whole report lives in cache_attributes can be answered from the store
+    use_store = result_dir != NULL && tenant_spec == NULL && sectors == 0 && wbuf_entries == 0 && dram_spec == NULL && !instructions
+                && outcome_file == NULL && diff_geometry[0] < 0 && !verbosity && interval == 0 && timing_spec == NULL && page_bits == 0;
+    if (use_store){
+        size_t len = 0;
+        if (set_count > 0) len += snprintf(result_options + len, sizeof(result_options) - len, " sets=%lld", set_count);
+        if (index_mode != INDEX_BITS) len += snprintf(result_options + len, sizeof(result_options) - len, " index=%d", index_mode);
+        for (int r = 0; index_mode == INDEX_MATRIX && r < matrix_rows && len < sizeof(result_options); r++){
+            len += snprintf(result_options + len, sizeof(result_options) - len, ",%llx", matrix[r]);
+        }
+        if (policy_opt) len += snprintf(result_options + len, sizeof(result_options) - len, " policy=opt");
+        if (classify) len += snprintf(result_options + len, sizeof(result_options) - len, " classify");
+        if (prefetch_kind >= 0) len += snprintf(result_options + len, sizeof(result_options) - len, " prefetch=%d/%d/%d/%d",
+                                                prefetch_kind, prefetch_degree, prefetch_distance, prefetch_latency);
+        if (victim_entries > 0) len += snprintf(result_options + len, sizeof(result_options) - len, " victim=%d", victim_entries);
+        result_key(key, sizeof(key), trace_hash, numLines, attributes, result_options);
+        if (result_lookup(result_dir, key, &attributes)){
+            printf("\n");
+            print_results(attributes, classify, prefetch_kind, victim_entries);
+            profile_mark(&prof, PHASE_REPORT);
+            print_profile(&prof, 0, -1);
+            return 0;
+        }
+    }
+
 
     this_cache = create_cache(num_sets, attributes.E, block_size); //initialize a cache using create_cache method
+    if (index_mode != INDEX_BITS || set_count > 0){
+        set_index_function(&this_cache, index_mode, num_sets, matrix, matrix_rows);
+    }
+    if (tenant_spec != NULL){
+        mem_address_tag masks[MAX_TENANTS];
+        for (int t = 0; t < num_tenants; t++){
+            masks[t] = tenants[t].mask;
+        }
+        this_cache.partition = create_partition(num_sets, attributes.E, masks, num_tenants);
+    }
+    else if (num_sets == 1 && attributes.E >= FA_ENGINE_WAYS && prefetch_kind < 0 && !policy_opt && sectors == 0){
+        attach_fa_engine(&this_cache);
+    }
+    if (sectors > 0){
+        set_sectors(&this_cache, sectors);
+    }
+    if (dram_spec != NULL){
+        this_cache.dram = create_dram(dram_spec, attributes.b);
+        if (this_cache.dram == NULL){
+            printf("%s: bad --dram %s (sizes must be powers of two, a row at least one block, queue 1-%d)\n",
+                   argv[0], dram_spec, DRAM_MAX_QUEUE);
+            exit(1);
+        }
+    }
+    if (wbuf_entries > 0){
+        this_cache.wbuf = create_write_buffer(wbuf_entries, wbuf_policy, wbuf_period);
+        this_cache.wbuf->dram = this_cache.dram;
+    }
+    this_cache.track_dirty = this_cache.wbuf != NULL || this_cache.dram != NULL;
+    if (instructions == 1){//split L1I: a bare cache with its own geometry (and run filter)
+        icache_attributes.s = icache_geometry[0];
+        icache_attributes.E = icache_geometry[1];
+        icache_attributes.b = icache_geometry[2];
+        icache_attributes.S = 1 << icache_attributes.s;
+        icache_attributes.B = 1 << icache_attributes.b;
+        icache = create_cache(1LL << icache_attributes.s, icache_attributes.E, 1LL << icache_attributes.b);
+        if (icache_attributes.s == 0 && icache_attributes.E >= FA_ENGINE_WAYS){
+            attach_fa_engine(&icache);
+        }
+        if (filter_size > 0){
+            icache.filter = create_run_filter(filter_size);
+        }
+    }
+    if (diff_geometry[0] >= 0){
+        diff = create_diff(diff_geometry, filter_size, diff_region_bits);
+    }
+    if (classify){
+        this_cache.classifier = create_classifier(num_sets, attributes.E);
+    }
+    if (policy_opt){
+        if (classify || prefetch_kind >= 0 || victim_entries > 0 || page_bits > 0 || dram_spec != NULL
+            || wbuf_entries > 0){
+            printf("%s: --policy opt runs the bare cache; drop --classify/--prefetch/--victim/--tlb/--dram/--write-buffer\n",
+                   argv[0]);
+            exit(1);
+        }
+        this_cache.opt = create_opt(operations, memAddresses, numLines, attributes.b, num_sets, attributes.E);
+    }
+    if (filter_size > 0){
+        this_cache.filter = create_run_filter(filter_size);
+    }
+    if (timing_spec != NULL){
+        this_cache.timing = create_timing(timing_spec, num_mshrs);
+        if (this_cache.timing == NULL){
+            printf("%s: bad --timing latencies %s\n", argv[0], timing_spec);
+            exit(1);
+        }
+    }
+    if (page_bits > 0){
+        this_cache.tlb = create_tlb(page_bits, dtlb_s, dtlb_E, stlb_s, stlb_E, pwc_s, pwc_E);
+    }
+    if (victim_entries > 0){
+        this_cache.victim = create_victim_cache(victim_entries);
+    }
+    if (prefetch_kind >= 0){
+        this_cache.prefetch = create_prefetcher(prefetch_kind, prefetch_degree, prefetch_distance, prefetch_latency);
+    }
+    if (instructions == 1){//fetch misses share the path to memory and the core's timeline with the data side
+        icache.dram = this_cache.dram;
+        icache.wbuf = this_cache.wbuf;
+        icache.timing = this_cache.timing;
+        icache.track_dirty = this_cache.track_dirty;
+    }
     printf("\n");
-    read_trace = fopen(trace_file,"r");
+    read_trace = (trace_file != NULL) ? fopen(trace_file,"r") : NULL;
+    if (interval > 0 && interval_open(&intervals, interval, interval_format, interval_file) != 0){
+        printf("%s: cannot open %s\n", argv[0], interval_file);
+        exit(1);
+    }
+    if (verbosity){
+        writer_open(&verbose, stdout, 1 << 22);
+    }
+    if (outcome_file != NULL){
+        outcomes = outcome_open(outcome_file, numLines, outcome_rle);
+        if (outcomes == NULL){
+            printf("%s: cannot open %s\n", argv[0], outcome_file);
+            exit(1);
+        }
+    }
+
+    profile_mark(&prof, PHASE_BUILD);
+    profile_counters(&prof, 1);
+    if (tenant_spec != NULL){
+        attributes = run_tenants(this_cache, attributes, tenants, num_tenants);
+    }
+    if (have_stream){
+        attributes = replay_blocks(this_cache, attributes, &stream);
+        block_stream_close(&stream);
+        numLines = 0; //nothing left for the record loop
+    }
 
     /* based on the operation type provided, simulate the cache */
    for (int i = 0; i< numLines; i++){
-        if (operations[i]== 'I'){
-            //do nothing
+        if (operations[i]== 'I' && !instructions){
+            if (outcomes != NULL){//kept only so the outcome stream lines up with the trace
+                outcome_record(outcomes, OUTCOME_NONE);
+            }
+            continue; //do nothing
+        }
+        if (verbosity){
+            writer_access(&verbose, operations[i], memAddresses[i], sizes[i]);
+        }
+        if (verbosity || outcomes != NULL){
+            before = attributes;
+        }
+        if (operations[i] == 'I' && instructions == 1){//instruction fetch, split L1I
+            if (verbosity || outcomes != NULL){
+                before = icache_attributes; //the outcome below reports the L1I
+            }
+            icache_attributes = simulate_cache(icache, icache_attributes, memAddresses[i], 0);
+        } else if (operations[i] == 'I'){//instruction fetch, unified L1
+            cache_attributes start = attributes;
+            attributes = simulate_paired(this_cache, attributes, diff, memAddresses[i], 0);
+            fetches.hits += attributes.hits - start.hits;
+            fetches.misses += attributes.misses - start.misses;
+            fetches.evicts += attributes.evicts - start.evicts;
         } else if (operations[i] == 'L'){//Load
-            attributes = simulate_cache(this_cache, attributes, memAddresses[i]);
+            attributes = simulate_paired(this_cache, attributes, diff, memAddresses[i], 0);
         } else if (operations[i] == 'S'){//Store
-            attributes = simulate_cache(this_cache, attributes, memAddresses[i]);
-        } else if (operations[i] == 'M'){//Modify
-            attributes = simulate_cache(this_cache, attributes, memAddresses[i]);
-            attributes = simulate_cache(this_cache, attributes, memAddresses[i]); 
+            attributes = simulate_paired(this_cache, attributes, diff, memAddresses[i], 1);
+        } else if (operations[i] == 'M'){//Modify: a load, then a store
+            attributes = simulate_paired(this_cache, attributes, diff, memAddresses[i], 0);
+            cache_attributes loaded = attributes;
+            if (verbosity){
+                writer_outcome(&verbose, before, attributes);
+            }
+            attributes = simulate_paired(this_cache, attributes, diff, memAddresses[i], 1);
+            if (outcomes != NULL){//the worse half (hit < miss < miss+eviction)
+                unsigned char load_code = outcome_code(before, loaded);
+                unsigned char store_code = outcome_code(loaded, attributes);
+                outcome_record(outcomes, load_code > store_code ? load_code : store_code);
+            }
+            before = loaded;
+        }
+        if (outcomes != NULL && operations[i] != 'M'){
+            outcome_record(outcomes, outcome_code(before, (operations[i] == 'I' && instructions == 1) ? icache_attributes : attributes));
         }
+        if (verbosity){
+            writer_outcome(&verbose, before, (operations[i] == 'I' && instructions == 1) ? icache_attributes : attributes);
+            verbose.buf[verbose.len++] = '\n';
+        }
+        if (interval > 0 && attributes.hits + attributes.misses >= intervals.next){
+            interval_emit(&intervals, attributes);
+        }
+    }
+    if (interval > 0){
+        interval_close(&intervals, attributes);
+    }
+
+    if (verbosity){
+        writer_close(&verbose);
+    }
+    if (outcomes != NULL && outcome_close(outcomes) != 0){
+        printf("%s: error writing %s\n", argv[0], outcome_file);
+        exit(1);
+    }
+    profile_counters(&prof, 0);
+    profile_mark(&prof, PHASE_SIMULATE);
+
+    if (use_store){
+        result_store(result_dir, key, attributes);
     }
 
     /* print out real results */
-    printSummary(attributes.hits, attributes.misses, attributes.evicts);
-    fclose(read_trace);
+    print_results(attributes, classify, prefetch_kind, victim_entries);
+    if (sectors > 0){
+        printf("tag misses:%d sector misses:%d writebacks:%d\n", attributes.tag_misses, attributes.sector_misses,
+               attributes.writebacks);
+    }
+    if (wbuf_entries > 0){
+        print_write_buffer(this_cache.wbuf);
+    }
+    if (dram_spec != NULL){
+        print_dram(this_cache.dram);
+    }
+    if (instructions){//fetches on their own line; data is the rest of the (split or unified) counters
+        if (instructions == 1){
+            fetches = icache_attributes;
+        }
+        printf("instruction hits:%d misses:%d evictions:%d\n", fetches.hits, fetches.misses, fetches.evicts);
+        printf("data hits:%d misses:%d evictions:%d\n", attributes.hits - (instructions == 2 ? fetches.hits : 0),
+               attributes.misses - (instructions == 2 ? fetches.misses : 0), attributes.evicts - (instructions == 2 ? fetches.evicts : 0));
+    }
+    if (tenant_spec != NULL){
+        print_tenants(this_cache.partition, tenants, num_tenants);
+    }
+    if (diff != NULL){
+        print_diff(diff);
+    }
+    if (timing_spec != NULL){
+        print_timing(this_cache.timing);
+    }
+    if (page_bits > 0){
+        tlb_model *tlb = this_cache.tlb;
+        printf("dtlb hits:%d misses:%d\n", tlb->dtlb_stats.hits, tlb->dtlb_stats.misses);
+        if (tlb->use_stlb){
+            printf("stlb hits:%d misses:%d\n", tlb->stlb_stats.hits, tlb->stlb_stats.misses);
+        }
+        printf("page walks:%d walk refs:%lld\n", tlb->walks, tlb->walk_refs);
+    }
+    profile_mark(&prof, PHASE_REPORT);
+    print_profile(&prof, (long long) attributes.hits + attributes.misses,
+                  this_cache.filter != NULL ? this_cache.filter->filtered : -1);
+    if (read_trace != NULL){
+        fclose(read_trace);
+    }
 
     return 0;
 }
\ No newline at end of file